@@ -20,11 +20,91 @@
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
 #include "../src/app/command.h"
+#include <stdlib.h>
 
 command command_processor;
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-int main()
+void usage(const char * program)
 {
+    IO << F("Usage: ") << program << F(" [-m <megabytes>] [-f <megabytes>] [-F <path>] [-t <seconds>] [-k <count>] [-w]") << endl
+       << F("    -m <megabytes>    Most memory each login's scrypt may use, default is all it wants") << endl
+       << F("    -f <megabytes>    Keep this much of scrypt's V array in a memory mapped file instead,") << endl
+       << F("                      with -m saying how much goes in memory alongside it") << endl
+       << F("    -F <path>         Directory, or file name to add a random suffix to, for the temporary") << endl
+       << F("                      files -f maps. Default is an anonymous memory file") << endl
+       << F("    -t <seconds>      How long a master key is kept so logging in again is quick. Default") << endl
+       << F("                      is ") << MPW_KEY_CACHE_TTL_MS / 1000 << F(", 0 never keeps one") << endl
+       << F("    -k <count>        Most master keys kept at once, default ") << MPW_KEY_CACHE_MAX_ENTRIES << endl
+       << F("    -w                Get scrypt's memory allocated and paged in at startup, so the first") << endl
+       << F("                      login doesn't wait for it. It stays resident until exit") << endl;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int main(int argc, char * argv[])
+{
+    scrypt_options options;
+    uint32_t key_cache_ttl_ms = MPW_KEY_CACHE_TTL_MS;
+    uint8_t key_cache_entries = MPW_KEY_CACHE_MAX_ENTRIES;
+    bool prewarm = false;
+    for(int i=1; i<argc; i++)
+    {
+        if ( ( strcmp(argv[i], "-m") == 0 ) && ( i+1 < argc ) )
+        {
+            int megabytes = atoi(argv[++i]);
+            if ( ( megabytes <= 0 ) || ( megabytes > 4095 ) )
+            {
+                IO << F("Memory budget must be between 1 and 4095 megabytes") << endl;
+                return 1;
+            }
+            options.memory_budget = (uint32_t)megabytes * 1024 * 1024;
+        }
+        else if ( ( strcmp(argv[i], "-f") == 0 ) && ( i+1 < argc ) )
+        {
+            int megabytes = atoi(argv[++i]);
+            if ( ( megabytes <= 0 ) || ( megabytes > 4095 ) )
+            {
+                IO << F("Mapped file size must be between 1 and 4095 megabytes") << endl;
+                return 1;
+            }
+            options.global_size = (uint32_t)megabytes * 1024 * 1024;
+        }
+        else if ( ( strcmp(argv[i], "-F") == 0 ) && ( i+1 < argc ) )
+        {
+            options.global_file = argv[++i];
+        }
+        else if ( ( strcmp(argv[i], "-t") == 0 ) && ( i+1 < argc ) )
+        {
+            int seconds = atoi(argv[++i]);
+            if ( ( seconds < 0 ) || ( seconds > 24*60*60 ) )
+            {
+                IO << F("Master key cache time must be between 0 and 86400 seconds") << endl;
+                return 1;
+            }
+            key_cache_ttl_ms = (uint32_t)seconds * 1000;
+        }
+        else if ( ( strcmp(argv[i], "-k") == 0 ) && ( i+1 < argc ) )
+        {
+            int count = atoi(argv[++i]);
+            if ( ( count < 0 ) || ( count > 255 ) )
+            {
+                IO << F("Master key cache size must be between 0 and 255") << endl;
+                return 1;
+            }
+            key_cache_entries = count;
+        }
+        else if ( strcmp(argv[i], "-w") == 0 )
+        {
+            prewarm = true;
+        }
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    command_processor.set_scrypt_options(options);
+    command_processor.set_key_cache(key_cache_ttl_ms, key_cache_entries);
+    command_processor.set_prewarm(prewarm);
     command_processor.setup();
     while( command_processor.is_running())
         command_processor.loop();    
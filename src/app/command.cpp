@@ -21,6 +21,10 @@
 
 #include "command.h"
 #include <string.h>
+#include <ctype.h>
+#ifndef ARDUINO
+#include <random>
+#endif
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 #define SKIP_WHITESPACE(p)      while((*p == ' ') || (*p == '\t')) p++;
@@ -41,7 +45,10 @@
 #define NEXT_ARG(n)             const char * n = strtok_r( NULL, ARGUMENT_SEPARATOR, &saveptr ); \
                                 CHECK_ARG(n)
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-command::command(void)
+command::command(void) : m_current_user(0), m_started_login(USER_NOT_FOUND)
+#ifndef ARDUINO
+    , m_prewarm(false)
+#endif
 {
     memset(m_users, 0, sizeof(m_users));
 }
@@ -53,6 +60,7 @@ command::~command(void)
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void command::release_users(void)
 {
+    cancel_all_logins();
     for(uint8_t i=0;i<countof(m_users);i++)
     {
         if ( m_users[i] != 0 )
@@ -69,13 +77,28 @@ void command::setup(void)
     m_is_running = true;
 #endif
     IO.begin(115200);
+#ifdef ARDUINO
+    // How long it took for someone to open the serial port is as good a seed as any for tokens
+    randomSeed(micros());
+#endif
     banner();
+#ifndef ARDUINO
+    // Get the scrypt memory paged in while the user is still typing. It stays resident from
+    // here on, so only when asked
+    if ( m_prewarm )
+    {
+        MPW prewarmer;
+        prewarmer.prewarm(m_scrypt_options);
+    }
+#endif
     reset();
     load();
 }
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void command::loop(void)
 {
+    service_logins();
+
     if (IO.available() == 0)
         return;
 
@@ -123,6 +146,13 @@ void command::reset(void)
     if ( !is_running() )
         return;
     m_command_index = 0;
+    prompt();
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void command::prompt(void)
+{
+    if ( !is_running() )
+        return;
 #ifndef ARDUINO    
     IO << F("EMPW> ");
 #endif
@@ -149,9 +179,13 @@ bool command::is_running(void)
 //      - Select site example.com
 //      - Generate a long password
 //
+//  A login carries on in the background, so whatever follows it on the line is kept back
+//  until the login is done. Commands on other lines are dealt with in the meantime
+//
 void command::handle_command(char * pcommand)
 {
     SKIP_WHITESPACE(pcommand);
+    char * end = pcommand + strlen(pcommand);
 
     char * saveptr;
     char * token = strtok_r( pcommand, COMMAND_SEPARATOR, &saveptr );
@@ -159,8 +193,22 @@ void command::handle_command(char * pcommand)
     while( token != NULL )
     {
         SKIP_WHITESPACE(token);
+        // Where the rest of the line starts, before the command gets chopped up into arguments
+        char * rest = token + strlen(token);
+        if ( rest < end )
+            rest++;
         // Dispatch this command
+        m_started_login = USER_NOT_FOUND;
         dispatch(token);
+        uint8_t started_login = m_started_login;
+        m_started_login = USER_NOT_FOUND;
+        if ( started_login != USER_NOT_FOUND )
+        {
+            SKIP_WHITESPACE(rest);
+            if ( *rest != 0 )
+                m_pending[started_login].deferred = strdup(rest);
+            return;
+        }
         token = strtok_r( NULL, COMMAND_SEPARATOR, &saveptr );
     }
 }
@@ -174,6 +222,8 @@ bool command::dispatch(char * pcommand)
         handle_login(pcommand+6);
     else if ( strncmp( pcommand, "logout ", 7 ) == 0 )
         handle_logout(pcommand+7);
+    else if ( strncmp( pcommand, "status ", 7 ) == 0 )
+        handle_status(pcommand+7);
     else if ( strncmp( pcommand, "user ", 5 ) == 0 )
         handle_switch_user(pcommand+5);
     else if ( strncmp( pcommand, "users", 6 ) == 0 )
@@ -219,9 +269,13 @@ bool command::dispatch(char * pcommand)
         handle_reset();
     else if ( strncmp( pcommand, "erase", 6) == 0 )         // Includes \0 to avoid matching substrings
         handle_erase();
+    else if ( strncmp( pcommand, "flush", 6) == 0 )         // Includes \0 to avoid matching substrings
+        handle_flush();
 #ifndef ARDUINO
     else if ( strncmp( pcommand, "exit", 5) == 0 )
     {
+        // Let logins still going finish, along with anything waiting on them
+        wait_all_logins(true);
         m_is_running = false;
         return false;
     } 
@@ -241,8 +295,9 @@ void command::handle_help(void)
     IO
         << F("Users") << endl 
         << F("-----") << endl
-        << F("login <user>, <password>          - Login <user> with <password>") << endl
-        << F("logout <token>                    - Logout user <token>") << endl
+        << F("login <user>, <password>          - Login <user> with <password>, in the background") << endl
+        << F("status <token>                    - Show how far the login of user <token> has got") << endl
+        << F("logout <token>                    - Logout user <token>, or stop their login") << endl
         << F("user <token>                      - Switch to user <token>") << endl
         << F("users                             - List remembered users") << endl
         << F("adduser <user>                    - Add <user> to the persistent user list") << endl
@@ -274,6 +329,7 @@ void command::handle_help(void)
         << F("help                              - Show this help screen") << endl
         << F("reset                             - Reset EMPW program (users need to log in again)") << endl
         << F("erase                             - Erase all remembered sites for all users") << endl
+        << F("flush                             - Forget the master keys kept to make logging in again quick") << endl
 #ifndef ARDUINO
         << F("exit                              - Exit the EMPW program") << endl
 #endif        
@@ -319,7 +375,7 @@ uint8_t command::find_user(uint32_t token) const
         {
             continue;
         }
-        if ( m_users[i]->get_mpw().get_login_token() == token )
+        if ( ( token != 0 ) && ( m_users[i]->get_token() == token ) )
         {
             return i;
         }
@@ -329,9 +385,6 @@ uint8_t command::find_user(uint32_t token) const
     return USER_NOT_FOUND;
 }
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-#ifndef ARDUINO
-#include <ctime>
-#endif 
 void command::handle_login(char * pdata)
 {
     m_current_user = NULL;
@@ -340,41 +393,205 @@ void command::handle_login(char * pdata)
     FIRST_ARG(username);
     NEXT_ARG(password);
 
+    // On Arduino any other login has to finish first, there's only the memory for one V array
+    // at a time
+#ifdef ARDUINO
+    wait_all_logins(true);
+#endif
     uint8_t user_index = find_user(username, false);
     if ( user_index == USER_NOT_FOUND )
+        user_index = MAX_PERSISTENT_USERS;
+    // A login still going for this user, or for the temporary user this one replaces, is
+    // overtaken by this one
+    cancel_login(user_index);
+
+    if ( user_index == MAX_PERSISTENT_USERS )
     {
         // Dynamic/temp user already present, so this gets logged out
         if ( m_users[MAX_PERSISTENT_USERS] != 0 )
             delete m_users[MAX_PERSISTENT_USERS];
         m_users[MAX_PERSISTENT_USERS] = new userinfo(username);
-        user_index = MAX_PERSISTENT_USERS;
     }
 
     m_current_user = m_users[user_index];
+    uint32_t token = new_token();
+    m_current_user->set_token(token);
+    m_current_user->get_mpw().set_key_cache(&m_key_cache);
+
+    pending_login& pending = m_pending[user_index];
+    pending.active = true;
+    pending.done = false;
+    pending.progress = 0;
+    pending.warnings = 0;
+    // Warnings wait for finish_login, on Linux the scrypt runs on the worker
+    scrypt_options options = m_scrypt_options;
+    options.quiet = true;
+#ifndef ARDUINO
+    // The worker needs its own copy of the details, the command line won't last that long
+    char * name_copy = strdup(username);
+    char * password_copy = strdup(password);
+    if ( ( name_copy == 0 ) || ( password_copy == 0 ) )
+    {
+        IO << F("Failed to allocate login details") << endl;
+        empw_exit(EXITCODE_NO_MEMORY);
+    }
+    MPW& mpw = m_current_user->get_mpw();
+    pending.worker = std::thread( [&pending, &mpw, name_copy, password_copy, options] () {
+        mpw.login(name_copy, password_copy, [&pending] (uint8_t percent) { pending.progress = percent; }, options, &pending.cancel);
+        memset( password_copy, 0, strlen(password_copy) );
+        free(password_copy);
+        free(name_copy);
+        pending.done = true;
+    });
+#else
+    m_current_user->get_mpw().begin_login(username, password, [&pending] (uint8_t percent) { pending.progress = percent; }, options);
+#endif
+    m_started_login = user_index;
 
-    #ifdef ARDUINO
-    uint32_t start = 0;
-    #else
-    std::clock_t start = 0;
-    #endif
-    m_current_user->get_mpw().login(username, password,
-        [&] (uint8_t percent) {
-            #ifdef ARDUINO
-            if ( ( millis() - start ) > 1000 )
-            #else
-            if ( ( std::clock() - start ) > CLOCKS_PER_SEC )
-            #endif
+    IO  << F("User [") << username << F("] logging in") << endl
+        << F("TOKEN:") << token << endl;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void command::handle_status(char * pdata)
+{
+    FIRST_ARG(usertoken);
+    uint32_t token = atoi(usertoken);
+    uint8_t user_index = find_user(token);
+    if ( user_index == USER_NOT_FOUND )
+        IO << "Couldn't find user with token " << token << endl;
+    else if ( is_pending(user_index) )
+        IO << "User `" << m_users[user_index]->get_user_name() << "` logging in ... " << m_pending[user_index].progress << "%" << endl;
+    else
+    {
+        IO << "User `" << m_users[user_index]->get_user_name() << "` logged in" << endl;
+        report_login_warnings(m_pending[user_index].warnings);
+    }
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+uint32_t command::new_token(void) const
+{
+    // A token has to exist before the master key does, so it can't come from the key like the
+    // MPW login token. All it needs to do is tell users apart and not be easy to guess
+    uint32_t token;
+    do
+    {
+#ifdef ARDUINO
+        token = ( random(0x7fffffff) ^ micros() ) & 0x7fffffff;
+#else
+        token = std::random_device()() & 0x7fffffff;
+#endif
+    } while ( ( token == 0 ) || ( find_user(token) != USER_NOT_FOUND ) );
+    return token;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void command::service_logins(void)
+{
+    for(uint8_t i=0; i<countof(m_pending); i++)
+    {
+        if ( !is_pending(i) )
+            continue;
+#ifdef ARDUINO
+        if ( !m_pending[i].done )
+            m_pending[i].done = m_users[i]->get_mpw().step_login(LOGIN_SLICE);
+#endif
+        if ( m_pending[i].done )
+        {
+            finish_login(i, true);
+            prompt();
+        }
+    }
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void command::wait_login(uint8_t user_index, bool run_deferred)
+{
+    if ( !is_pending(user_index) )
+        return;
+#ifdef ARDUINO
+    while ( !m_pending[user_index].done )
+        m_pending[user_index].done = m_users[user_index]->get_mpw().step_login(LOGIN_SLICE);
+#endif
+    finish_login(user_index, run_deferred);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void command::finish_login(uint8_t user_index, bool run_deferred)
+{
+    pending_login& pending = m_pending[user_index];
+#ifndef ARDUINO
+    pending.worker.join();
+#endif
+    pending.active = false;
+    pending.warnings = m_users[user_index]->get_mpw().get_scrypt_warnings();
+    char * deferred = pending.deferred;
+    pending.deferred = 0;
+
+    IO  << F("User [") << m_users[user_index]->get_user_name() << F("] logged in") << endl
+        << F("TOKEN:") << m_users[user_index]->get_token() << endl;
+    report_login_warnings(pending.warnings);
+
+    if ( deferred != 0 )
+    {
+        if ( run_deferred )
+        {
+            m_current_user = m_users[user_index];
+            handle_command(deferred);
+        }
+        free(deferred);
+    }
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void command::report_login_warnings(uint8_t warnings) const
+{
+    if ( warnings & SCRYPT_WARN_GLOBAL_MAP )
+        IO << F("Failed to map scrypt global tier, used the heap") << endl;
+    if ( warnings & SCRYPT_WARN_HEAP_SHORT )
+        IO << F("ROMix heap buffer was short, used a sparser V") << endl;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void command::wait_all_logins(bool run_deferred)
+{
+    // Commands that were waiting on one login can start another, so keep going until there
+    // are none left
+    bool waited = true;
+    while ( waited )
+    {
+        waited = false;
+        for(uint8_t i=0; i<countof(m_pending); i++)
+        {
+            if ( is_pending(i) )
             {
-                #ifdef ARDUINO
-                start = millis();
-                #else
-                start = std::clock();
-                #endif
-                IO << F("Calculating ... ") << percent << F("%") << endl;
+                wait_login(i, run_deferred);
+                waited = true;
             }
-        });
-    IO  << F("User [") << username << F("] logged in") << endl
-        << F("TOKEN:") << m_current_user->get_mpw().get_login_token() << endl;
+        }
+    }
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void command::cancel_login(uint8_t user_index)
+{
+    if ( !is_pending(user_index) )
+        return;
+    pending_login& pending = m_pending[user_index];
+#ifndef ARDUINO
+    pending.cancel.cancel();
+    pending.worker.join();
+    pending.cancel.reset();
+#endif
+    // Drops the scrypt if it's part way through, wiping its V, or the key if it got there first
+    m_users[user_index]->get_mpw().logout();
+    m_users[user_index]->set_token(0);
+    pending.active = false;
+    if ( pending.deferred != 0 )
+    {
+        free(pending.deferred);
+        pending.deferred = 0;
+    }
+    IO << F("Login of user [") << m_users[user_index]->get_user_name() << F("] stopped") << endl;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void command::cancel_all_logins(void)
+{
+    for(uint8_t i=0; i<countof(m_pending); i++)
+        cancel_login(i);
 }
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void command::handle_logout(char * pdata)
@@ -388,7 +605,9 @@ void command::handle_logout(char * pdata)
     }
     else
     {
+        cancel_login(user_index);
         m_users[user_index]->get_mpw().logout();
+        m_users[user_index]->set_token(0);
         IO << "Logged out user " << token << endl;
     }
 }
@@ -420,7 +639,9 @@ void command::handle_list_users(void)
             else
                 IO << F("  ");
             IO << "`" << m_users[i]->get_user_name() << "`";
-            if ( m_users[i]->get_mpw().is_logged_in())
+            if ( is_pending(i) )
+                IO << F(" (Logging in ") << m_pending[i].progress << F("%)");
+            else if ( m_users[i]->get_mpw().is_logged_in())
                 IO << F(" (Logged in)");
             IO << endl;
         }
@@ -461,6 +682,7 @@ void command::handle_remove_user(char * pdata)
         return;
     }
 
+    cancel_login(existing_user);
     delete m_users[existing_user];
     m_users[existing_user] = 0;
     save();
@@ -514,6 +736,14 @@ bool command::check_login(void) const
         IO << F("No current user, please login") << endl;
         return false;
     }
+    for(uint8_t i=0; i<countof(m_users); i++)
+    {
+        if ( ( m_users[i] == m_current_user ) && is_pending(i) )
+        {
+            IO << F("User `") << m_current_user->get_user_name() << F("` is still logging in, see `status ") << m_current_user->get_token() << F("`") << endl;
+            return false;
+        }
+    }
     return true;
 }
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -702,10 +932,18 @@ void command::handle_reset(void)
 void command::handle_erase(void)
 {
     release_users();
+    m_key_cache.flush();
     persistence p;
     p.erase();
 }
 ///////////////////////////////////////////////////////////////////////////////////////////////////
+void command::handle_flush(void)
+{
+    uint8_t count = m_key_cache.get_entry_count();
+    m_key_cache.flush();
+    IO << F("Forgot ") << count << F(" cached master key(s)") << endl;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
 void command::load(void)
 {
     persistence p;
@@ -26,11 +26,40 @@
 #include "../version.h"
 #include "persistence.h"
 #include <algorithm>
-
+#ifndef ARDUINO
+#include <atomic>
+#include <thread>
+#endif
 
 #define MAX_PERSISTENT_USERS        (9)
 #define MAX_COMMAND_LINE_LENGTH     (180)
 #define USER_NOT_FOUND              (255)
+// BlockMix steps of a login's scrypt done per loop() on Arduino, small enough that serial
+// input still gets a look in
+#define LOGIN_SLICE                 (64)
+
+// A login that's still working out its master key. On Linux the login has a worker thread
+// of its own, on Arduino loop() steps it along a slice at a time. Anything after the login
+// on the same command line waits in `deferred` until it's done. The scrypt keeps its warnings
+// to itself while the login runs, they end up in `warnings` for finish_login to report
+struct pending_login
+{
+    pending_login(void) : active(false), done(false), progress(0), deferred(0), warnings(0) {}
+
+    bool                    active;
+#ifndef ARDUINO
+    std::atomic<bool>       done;
+    std::atomic<uint8_t>    progress;
+    std::thread             worker;
+    scrypt_cancel_token     cancel;
+#else
+    bool                    done;
+    uint8_t                 progress;
+#endif
+    char *                  deferred;
+    // SCRYPT_WARN_ flags from the login's scrypt, kept after it's done for status
+    uint8_t                 warnings;
+};
 
 class command
 {
@@ -42,6 +71,15 @@ public:
     void loop(void);
     bool is_running(void);
     void handle_command(char * pcommand);
+    // Used for every login from here on
+    void set_scrypt_options(const scrypt_options& options) { m_scrypt_options = options; }
+    // How long master keys are kept so logging in again skips the scrypt, and how many of
+    // them. Either of them 0 and every login does the whole scrypt
+    void set_key_cache(uint32_t ttl_ms, uint8_t max_entries) { m_key_cache.set_ttl(ttl_ms); m_key_cache.set_max_entries(max_entries); }
+#ifndef ARDUINO
+    // Have setup() get the first login's scrypt memory allocated and paged in
+    void set_prewarm(bool prewarm) { m_prewarm = prewarm; }
+#endif
 
 private:
     void release_users(void);
@@ -54,9 +92,11 @@ private:
     void handle_help(void);
     void handle_reset(void);
     void handle_erase(void);
+    void handle_flush(void);
     
     // User commands
     void handle_login(char * pdata);
+    void handle_status(char * pdata);
     void handle_logout(char * pdata);
     void handle_switch_user(char * pdata);
     void handle_list_users(void);
@@ -84,15 +124,33 @@ private:
     siteinfo*   find_site(const char * sitename, bool show_complaint_on_failure);
     void        load(void);
     void        save(void);
+    void        prompt(void);
+
+    // Background logins, one slot per user slot
+    uint32_t    new_token(void) const;
+    bool        is_pending(uint8_t user_index) const { return m_pending[user_index].active; }
+    void        service_logins(void);
+    void        wait_login(uint8_t user_index, bool run_deferred);
+    void        finish_login(uint8_t user_index, bool run_deferred);
+    void        wait_all_logins(bool run_deferred);
+    void        cancel_login(uint8_t user_index);
+    void        cancel_all_logins(void);
+    void        report_login_warnings(uint8_t warnings) const;
 
 private:
     userinfo*                       m_users[MAX_PERSISTENT_USERS+1];
     userinfo*                       m_current_user;
+    pending_login                   m_pending[MAX_PERSISTENT_USERS+1];
+    // Set by handle_login to the user whose login it started
+    uint8_t                         m_started_login;
 
     char                            m_command_buffer[MAX_COMMAND_LINE_LENGTH];
     uint8_t                         m_command_index;
+    scrypt_options                  m_scrypt_options;
+    mpw_key_cache                   m_key_cache;
 #ifndef ARDUINO
     bool                            m_is_running;
+    bool                            m_prewarm;
 #endif
 };
 
@@ -34,14 +34,17 @@ private:
     userinfo() {}
     userinfo(const userinfo& other) {}
 public:
-    userinfo(const char * username) : m_username(username) {}
-    userinfo(const str_ptr& username) : m_username(username) {}
+    userinfo(const char * username) : m_username(username), m_token(0) {}
+    userinfo(const str_ptr& username) : m_username(username), m_token(0) {}
     ~userinfo(){}
 
     bool                    is_user(const char * u) const   { return m_username == u; }
     const char *            get_user_name(void)     const   { return m_username; }
     MPW&                    get_mpw(void)                   { return m_mpw; }
     std::vector<siteinfo>&  get_sites(void)                 { return m_sites; }
+    // Handed out when a login starts, 0 when there's no login
+    uint32_t                get_token(void)         const   { return m_token; }
+    void                    set_token(uint32_t token)       { m_token = token; }
 
     static userinfo *       load(persistence& p);
     void                    save(persistence& p) const;
@@ -50,6 +53,7 @@ private:
     MPW                     m_mpw;
     str_ptr                 m_username;
     std::vector<siteinfo>   m_sites;
+    uint32_t                m_token;
 };
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 inline userinfo * userinfo::load(persistence& p)
@@ -0,0 +1,95 @@
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  cpu.h - Header file for host CPU feature detection
+//
+//      Some of the algorithms have hardware accelerated versions on the bigger hosts. These
+//      helpers find out (once) what the CPU we're running on can do, so the fast paths can
+//      be picked at runtime while the portable code remains the fallback. Embedded builds
+//      never define EMPW_X86 and so only ever see the portable code.
+//
+//  Copyright (C) 2020, Gazoodle (https://github.com/gazoodle)
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef _inc_cpu_h
+#define _inc_cpu_h
+
+#if !defined(ARDUINO) && defined(__x86_64__) && ( defined(__GNUC__) || defined(__clang__) )
+#define EMPW_X86
+#endif
+
+#ifdef EMPW_X86
+
+#include <stdint.h>
+#include <cpuid.h>
+#include <immintrin.h>
+
+#define CPUID_1_ECX_SSSE3       (1<<9)
+#define CPUID_1_ECX_SSE41       (1<<19)
+#define CPUID_1_ECX_OSXSAVE     (1<<27)
+#define CPUID_1_ECX_AVX         (1<<28)
+#define CPUID_7_EBX_AVX2        (1<<5)
+#define CPUID_7_EBX_SHA         (1<<29)
+#define XCR0_SSE_AVX_STATE      (0x6)
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline bool cpu_detect_sha_ni(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+    if ( !__get_cpuid(1, &eax, &ebx, &ecx, &edx) )
+        return false;
+    // The SHA-NI code also leans on SSSE3 & SSE4.1 shuffles and blends
+    if ( ( ecx & ( CPUID_1_ECX_SSSE3 | CPUID_1_ECX_SSE41 ) ) != ( CPUID_1_ECX_SSSE3 | CPUID_1_ECX_SSE41 ) )
+        return false;
+    if ( !__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) )
+        return false;
+    return ( ebx & CPUID_7_EBX_SHA ) != 0;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline bool cpu_has_sha_ni(void)
+{
+    // Probed once, the first time anyone asks
+    static const bool has_sha_ni = cpu_detect_sha_ni();
+    return has_sha_ni;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline bool cpu_detect_avx2(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+    if ( !__get_cpuid(1, &eax, &ebx, &ecx, &edx) )
+        return false;
+    if ( ( ecx & ( CPUID_1_ECX_OSXSAVE | CPUID_1_ECX_AVX ) ) != ( CPUID_1_ECX_OSXSAVE | CPUID_1_ECX_AVX ) )
+        return false;
+    // The OS also has to be saving the upper halves of the registers for us
+    uint32_t xcr0_lo, xcr0_hi;
+    __asm__ ( "xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0) );
+    if ( ( xcr0_lo & XCR0_SSE_AVX_STATE ) != XCR0_SSE_AVX_STATE )
+        return false;
+    if ( !__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) )
+        return false;
+    return ( ebx & CPUID_7_EBX_AVX2 ) != 0;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline bool cpu_has_avx2(void)
+{
+    static const bool has_avx2 = cpu_detect_avx2();
+    return has_avx2;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif
+
+#endif
@@ -23,22 +23,44 @@
 //
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 template <class HASH_ALGO>
-HMAC<HASH_ALGO>::HMAC(const uint8_t *key, uint32_t key_size)
+void HMAC_key<HASH_ALGO>::set(const uint8_t *key, uint32_t key_size)
 {
+    HASH_ALGO   hash_algorithm;
+    uint8_t     padded_key[ HASH_ALGO::BLOCK_SIZE_BYTES ];
+
     // Slightly redundant code in the case that the supplied 
     // key is larger than hash key buffer
-    memset( m_key, 0, sizeof( m_key ));
+    memset( padded_key, 0, sizeof( padded_key ));
     // Algorithm states that if the key is larger than the algorithm chunk size, it must be hashed
     // otherwise it is used verbatim with the remaining characters zero filled
     if ( key_size > HASH_ALGO::BLOCK_SIZE_BYTES )
     {
-        m_hash_algorithm.enqueue(key, key_size);
-        memcpy( m_key, m_hash_algorithm.digest(), HASH_ALGO::HASH_SIZE_BYTES );
+        hash_algorithm.enqueue(key, key_size);
+        memcpy( padded_key, hash_algorithm.digest(), HASH_ALGO::HASH_SIZE_BYTES );
     }
     else
     {
-        memcpy( m_key, key, key_size );
+        memcpy( padded_key, key, key_size );
     }
+
+    // Compress the inner padded key and keep the state
+    hash_algorithm.reset();
+    for(uint8_t i=0;i<sizeof(padded_key);i++)
+        hash_algorithm.enqueue(padded_key[i] ^ HMAC_INNER_PADDING );
+    memcpy( m_inner_midstate, hash_algorithm.get_midstate(), sizeof(m_inner_midstate) );
+
+    // Same again for the outer padded key
+    hash_algorithm.reset();
+    for(uint8_t i=0;i<sizeof(padded_key);i++)
+        hash_algorithm.enqueue(padded_key[i] ^ HMAC_OUTER_PADDING );
+    memcpy( m_outer_midstate, hash_algorithm.get_midstate(), sizeof(m_outer_midstate) );
+
+    memset( padded_key, 0, sizeof( padded_key ));
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+template <class HASH_ALGO>
+HMAC<HASH_ALGO>::HMAC(const uint8_t *key, uint32_t key_size) : m_key(key, key_size)
+{
     // Reset HMAC ready for action
     reset();
 }
@@ -52,11 +74,8 @@ HMAC<HASH_ALGO>::HMAC(const uint8_t *key, uint32_t key_size, const uint8_t *mess
 template <class HASH_ALGO>
 void HMAC<HASH_ALGO>::reset(void)
 {
-    // Reset the hasher
-    m_hash_algorithm.reset();
-    // Initialize the hash algorithm using the inner padding
-    for(uint8_t i=0;i<sizeof(m_key);i++)
-        m_hash_algorithm.enqueue(m_key[i] ^ HMAC_INNER_PADDING );
+    // Pick up from the state after the inner padded key
+    m_hash_algorithm.set_midstate( m_key.get_inner_midstate(), HASH_ALGO::BLOCK_SIZE_BYTES );
 }
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 template <class HASH_ALGO>
@@ -65,11 +84,8 @@ const uint8_t * HMAC<HASH_ALGO>::digest(void)
     // Stash the inner hash
     uint8_t innerHash[HASH_ALGO::HASH_SIZE_BYTES];
     memcpy( innerHash, m_hash_algorithm.digest(), HASH_ALGO::HASH_SIZE_BYTES );
-    // Reset hasher for another round
-    m_hash_algorithm.reset();
-    // Put the padded outer key in
-    for(uint8_t i=0;i<sizeof(m_key);i++)
-        m_hash_algorithm.enqueue(m_key[i] ^ HMAC_OUTER_PADDING);
+    // Pick up from the state after the outer padded key
+    m_hash_algorithm.set_midstate( m_key.get_outer_midstate(), HASH_ALGO::BLOCK_SIZE_BYTES );
     // And add the inner hash
     m_hash_algorithm.enqueue(innerHash, HASH_ALGO::HASH_SIZE_BYTES );
     // Complete hash and return
@@ -26,6 +26,27 @@
 #define HMAC_OUTER_PADDING  (uint8_t)0x5C
 #define HMAC_INNER_PADDING  (uint8_t)0x36
 
+// The key, boiled down to the hash state after compressing the inner and outer padded
+// key blocks. Build it once and every HMAC made from it skips those two compressions
+template <class HASH_ALGO>
+class HMAC_key
+{
+public:
+    HMAC_key(void) { clear(); }
+    HMAC_key(const uint8_t *key, uint32_t key_size) { set(key, key_size); }
+    ~HMAC_key(void) { clear(); }
+
+    void set(const uint8_t *key, uint32_t key_size);
+    void clear(void) { memset(m_inner_midstate, 0, sizeof(m_inner_midstate)); memset(m_outer_midstate, 0, sizeof(m_outer_midstate)); }
+
+    const uint32_t * get_inner_midstate(void) const { return m_inner_midstate; }
+    const uint32_t * get_outer_midstate(void) const { return m_outer_midstate; }
+
+private:
+    uint32_t    m_inner_midstate[ HASH_ALGO::STATE_SIZE_WORDS ];
+    uint32_t    m_outer_midstate[ HASH_ALGO::STATE_SIZE_WORDS ];
+};
+
 template <class HASH_ALGO>
 class HMAC
 {
@@ -34,10 +55,13 @@ private:
 public:
     HMAC(const uint8_t *key, uint32_t key_size);
     HMAC(const uint8_t *key, uint32_t key_size, const uint8_t *message, uint32_t message_size );
+    // Cheap clones of an already prepared key
+    HMAC(const HMAC_key<HASH_ALGO>& key) : m_key(key) { reset(); }
+    HMAC(const HMAC_key<HASH_ALGO>& key, const uint8_t *message, uint32_t message_size ) : HMAC(key) { enqueue(message, message_size); }
     // Convenience constructors
     HMAC(const char *key) : HMAC(reinterpret_cast<const uint8_t *>(key), strlen(key)) { }
     HMAC(const char *key, const char *message) : HMAC(reinterpret_cast<const uint8_t *>(key), strlen(key), reinterpret_cast<const uint8_t *>(message), strlen(message)) { }
-    ~HMAC(void) { memset(m_key, 0, sizeof(m_key)); }
+    ~HMAC(void) {}
 
     static const uint8_t    BLOCK_SIZE_BYTES = HASH_ALGO::BLOCK_SIZE_BYTES;
     static const uint8_t    HASH_SIZE_BYTES = HASH_ALGO::HASH_SIZE_BYTES;
@@ -48,10 +72,12 @@ public:
     void enqueue(const uint8_t *bytes, uint32_t count) { m_hash_algorithm.enqueue(bytes, count); }
     void enqueue_be(uint32_t val) { m_hash_algorithm.enqueue_be(val); };
     const uint8_t * digest(void);
+    const HMAC_key<HASH_ALGO>& get_key(void) const { return m_key; }
+    void copy_from(const HMAC& other) { m_key = other.m_key; m_hash_algorithm.copy_from(other.m_hash_algorithm); }
 
 private:
-    uint8_t     m_key[ HASH_ALGO::BLOCK_SIZE_BYTES ];
-    HASH_ALGO   m_hash_algorithm;
+    HMAC_key<HASH_ALGO> m_key;
+    HASH_ALGO           m_hash_algorithm;
 };
 
 #include "hmac-impl.h"
@@ -0,0 +1,40 @@
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Multi-buffer HMAC-SHA256 implementation
+//
+//  References
+//      https://en.wikipedia.org/wiki/HMAC
+//      https://tools.ietf.org/html/rfc4231
+//
+//  Copyright (C) 2020, Gazoodle (https://github.com/gazoodle)
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline void HMACx8::hash(uint8_t count, const uint8_t * const * messages, const uint32_t * message_sizes)
+{
+    // Inner hashes of all the messages
+    m_inner.hash(count, messages, message_sizes, m_key.get_inner_midstate(), BLOCK_SIZE_BYTES);
+
+    // Then the outer hashes of the inner hashes
+    const uint8_t * inner_hashes[LANES];
+    uint32_t        inner_sizes[LANES];
+    for(uint8_t lane=0; lane<count; lane++)
+    {
+        inner_hashes[lane] = m_inner.digest(lane);
+        inner_sizes[lane] = HASH_SIZE_BYTES;
+    }
+    m_outer.hash(count, inner_hashes, inner_sizes, m_key.get_outer_midstate(), BLOCK_SIZE_BYTES);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
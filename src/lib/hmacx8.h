@@ -0,0 +1,59 @@
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  hmacx8.h - Header file for multi-buffer HMAC-SHA256 implementation
+//
+//      HMAC<SHA256> for up to eight messages under the same key at once, built on SHA256x8.
+//      The key is held as an HMAC_key, so the padded key blocks are never compressed again and
+//      every batch costs the same as a single HMAC of the longest message.
+//
+//  Copyright (C) 2020, Gazoodle (https://github.com/gazoodle)
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef _inc_hmacx8_h
+#define _inc_hmacx8_h
+
+#include "sha256x8.h"
+#include "hmac.h"
+
+class HMACx8
+{
+private:
+    HMACx8(const HMACx8& other) {}
+public:
+    HMACx8(const uint8_t *key, uint32_t key_size) : m_key(key, key_size) {}
+    HMACx8(const HMAC_key<SHA256>& key) : m_key(key) {}
+    // Convenience constructor
+    HMACx8(const char *key) : HMACx8(reinterpret_cast<const uint8_t *>(key), strlen(key)) { }
+    ~HMACx8(void) {}
+
+    static const uint8_t    LANES = SHA256x8::LANES;
+    static const uint8_t    BLOCK_SIZE_BYTES = SHA256x8::BLOCK_SIZE_BYTES;
+    static const uint8_t    HASH_SIZE_BYTES = SHA256x8::HASH_SIZE_BYTES;
+
+public:
+    void hash(uint8_t count, const uint8_t * const * messages, const uint32_t * message_sizes);
+    const uint8_t * digest(uint8_t lane) const { return m_outer.digest(lane); }
+
+private:
+    HMAC_key<SHA256>    m_key;
+    SHA256x8            m_inner;
+    SHA256x8            m_outer;
+};
+
+#include "hmacx8-impl.h"
+
+#endif
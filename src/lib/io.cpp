@@ -20,6 +20,10 @@
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
 #include "io.h"
+#ifndef ARDUINO
+#include <poll.h>
+#include <unistd.h>
+#endif
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
 //
@@ -62,8 +66,13 @@ bool _IO::available(void)
     #else
     if ( m_last_char != EOF)
         return true;
-    m_last_char = getchar();
-    return false;
+    // Only wait a little while for input, so whoever's polling gets a look in every so often
+    // to get on with other things, like finishing off logins running in the background
+    struct pollfd fd = { STDIN_FILENO, POLLIN, 0 };
+    uint8_t c;
+    if ( ( poll( &fd, 1, IO_POLL_MS ) > 0 ) && ( ::read( STDIN_FILENO, &c, 1 ) == 1 ) )
+        m_last_char = c;
+    return m_last_char != EOF;
     #endif
 }
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -72,8 +81,8 @@ int _IO::read(void)
     #ifdef ARDUINO
     return Serial.read();
     #else
-    while( m_last_char == EOF )
-        m_last_char = getchar();
+    while( !available() )
+        ;
     int retval = m_last_char;
     m_last_char = EOF;
     return retval;
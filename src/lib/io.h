@@ -35,6 +35,8 @@
 #include <stdint.h>
 #include <string.h>
 
+// Longest available() waits for input before saying there isn't any
+#define IO_POLL_MS      (50)
 
 // TODO: Needs tidying up and fixing 
 class Print
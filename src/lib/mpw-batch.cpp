@@ -0,0 +1,223 @@
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Batch Master Password login
+//
+//  Copyright (C) 2020, Gazoodle (https://github.com/gazoodle)
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef ARDUINO
+
+#include "mpw-batch.h"
+#include <unistd.h>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+mpw_batch::mpw_batch(uint32_t workers, uint64_t memory_budget, const scrypt_options& options)
+    : m_options(options), m_job_slots(1), m_next_job(0), m_jobs_done(0), m_stopping(false)
+{
+    // The jobs run on the workers, which mustn't write to IO
+    m_options.quiet = true;
+    if ( memory_budget == 0 )
+        memory_budget = (uint64_t)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGE_SIZE) / 2;
+    if ( memory_budget / get_job_memory() > 1 )
+        m_job_slots = memory_budget / get_job_memory();
+
+    if ( workers == 0 )
+        workers = mix_max( std::thread::hardware_concurrency(), 1u );
+    workers = mix_min( workers, m_job_slots );
+
+    for(uint32_t i=0; i<workers; i++)
+        m_workers.push_back( std::thread( [this] () { worker(); } ) );
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+mpw_batch::~mpw_batch(void)
+{
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_stopping = true;
+    }
+    m_wake_worker.notify_all();
+    for(uint32_t i=0; i<m_workers.size(); i++)
+        m_workers[i].join();
+
+    for(uint32_t i=0; i<m_jobs.size(); i++)
+    {
+        job& j = m_jobs[i];
+        if ( j.password != 0 )
+        {
+            memset( j.password, 0, strlen(j.password) );
+            free(j.password);
+        }
+        free(j.name);
+        memset( j.master_key, 0, sizeof(j.master_key) );
+    }
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+scrypt_options mpw_batch::default_options(void)
+{
+    scrypt_options options;
+    options.lane_mode = SCRYPT_LANES_SEQUENTIAL;
+    return options;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+uint64_t mpw_batch::get_job_memory(void) const
+{
+    scrypt<SCRYPT_N, SCRYPT_R, SCRYPT_P, MASTER_KEY_LEN> holder;
+    holder.set_options(m_options);
+    uint64_t full_size = (uint64_t)SCRYPT_N * SCRYPT_R * 2 * sizeof(Salsa20Block) * holder.concurrent_lanes();
+    if ( ( m_options.memory_budget > 0 ) && ( m_options.memory_budget < full_size ) )
+        return m_options.memory_budget;
+    return full_size;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+uint32_t mpw_batch::add(const char *name, const char *password)
+{
+    char* name_copy = strdup(name);
+    char* password_copy = strdup(password);
+    if ( ( name_copy == 0 ) || ( password_copy == 0 ) )
+    {
+        IO << F("Failed to allocate batch login job") << endl;
+        empw_exit(EXITCODE_NO_MEMORY);
+    }
+
+    uint32_t index;
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        index = m_jobs.size();
+        m_jobs.emplace_back();
+        m_jobs.back().name = name_copy;
+        m_jobs.back().password = password_copy;
+    }
+    m_wake_worker.notify_one();
+    return index;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void mpw_batch::wait(progress_func progress)
+{
+    std::unique_lock<std::mutex> guard(m_lock);
+    uint8_t reported = 0;
+    if (progress)(progress)(0);
+    while ( m_jobs_done < m_jobs.size() )
+    {
+        if ( !progress )
+        {
+            m_job_done.wait(guard);
+            continue;
+        }
+        m_job_done.wait_for(guard, std::chrono::milliseconds(SCRYPT_THREAD_PROGRESS_MS));
+        uint32_t total = 0;
+        for(uint32_t i=0; i<m_jobs.size(); i++)
+            total += m_jobs[i].progress.load(std::memory_order_relaxed);
+        if ( total / m_jobs.size() > reported )
+        {
+            reported = total / m_jobs.size();
+            (progress)(reported);
+        }
+    }
+    if ( progress && ( reported < 100 ) )(progress)(100);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+uint32_t mpw_batch::get_job_count(void) const
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    return m_jobs.size();
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+uint8_t mpw_batch::get_progress(uint32_t job) const
+{
+    return job_at(job).progress.load(std::memory_order_relaxed);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+const uint8_t * mpw_batch::get_master_key(uint32_t job) const
+{
+    const mpw_batch::job& j = job_at(job);
+    return j.done ? j.master_key : 0;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+uint8_t mpw_batch::get_warnings(uint32_t job) const
+{
+    const mpw_batch::job& j = job_at(job);
+    return j.done ? j.warnings : 0;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool mpw_batch::login(uint32_t job, MPW& mpw) const
+{
+    const uint8_t* master_key = get_master_key(job);
+    if ( master_key == 0 )
+        return false;
+    mpw.login(master_key);
+    return true;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+const mpw_batch::job& mpw_batch::job_at(uint32_t index) const
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    if ( index >= m_jobs.size() )
+    {
+        IO << F("Batch login job ") << index << F(" doesn't exist") << endl;
+        empw_exit(EXITCODE_LOGIC_FAULT);
+    }
+    return m_jobs[index];
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void mpw_batch::worker(void)
+{
+    // One scrypt per worker, reused for every job it picks up
+    scrypt<SCRYPT_N, SCRYPT_R, SCRYPT_P, MASTER_KEY_LEN> holder;
+    holder.set_options(m_options);
+
+    std::unique_lock<std::mutex> guard(m_lock);
+    while ( true )
+    {
+        m_wake_worker.wait(guard, [this] () { return m_stopping || ( m_next_job < m_jobs.size() ); });
+        if ( m_stopping )
+            return;
+        job& j = m_jobs[m_next_job++];
+
+        guard.unlock();
+        derive(j, holder);
+        guard.lock();
+
+        m_jobs_done++;
+        m_job_done.notify_all();
+    }
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void mpw_batch::derive(job& j, scrypt<SCRYPT_N, SCRYPT_R, SCRYPT_P, MASTER_KEY_LEN>& holder)
+{
+    uint32_t seed_buffer_len;
+    uint8_t *seed_buffer = MPW::create_login_seed(j.name, seed_buffer_len);
+    uint32_t password_len = strlen(j.password);
+
+    const uint8_t* master_key = holder.hash(reinterpret_cast<const uint8_t *>(j.password), password_len, seed_buffer, seed_buffer_len, [&] ( uint8_t percent ) {
+        j.progress.store(percent, std::memory_order_relaxed);
+    });
+    memcpy( j.master_key, master_key, MASTER_KEY_LEN );
+    j.warnings = holder.get_warnings();
+    holder.Reset();
+
+    // Clean up please, the password isn't needed again
+    free(seed_buffer);
+    memset( j.password, 0, password_len );
+    free(j.password);
+    j.password = 0;
+
+    j.progress.store(100, std::memory_order_relaxed);
+    j.done = true;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif
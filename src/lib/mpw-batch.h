@@ -0,0 +1,118 @@
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  mpw-batch.h - Header file for deriving many master keys at once
+//
+//      MPW::login works out one master key and blocks until it has it, which is fine for a
+//      person at a keyboard and hopeless for a migration or an audit that has hundreds of
+//      identities to log in. mpw_batch takes (name, password) jobs and runs them on a fixed
+//      pool of worker threads as they are added. Every running job holds a V array for as
+//      long as it mixes, so the pool is never bigger than the number of V arrays that fit in
+//      a memory budget, which keeps a big batch from pushing the host into swap. Each job has
+//      its own progress and ends up with a master key that can be read out directly or used
+//      to log an MPW in. Host only.
+//
+//  Copyright (C) 2020, Gazoodle (https://github.com/gazoodle)
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef _inc_mpw_batch_h
+#define _inc_mpw_batch_h
+
+#ifndef ARDUINO
+
+#include "mpw.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class mpw_batch
+{
+private:
+    mpw_batch(const mpw_batch& other) {}
+public:
+    // `workers` threads (0 for one per CPU) sharing `memory_budget` bytes of V array (0 for
+    // half the physical memory). There are never more workers than jobs that fit in the
+    // budget. Every job is derived with `options`, which default to one lane at a time as
+    // the parallelism comes from running jobs side by side. The jobs always run quiet, their
+    // warnings are kept for get_warnings(). Each job's hash gets a global tier file of its
+    // own even when `global_file` names one, see scrypt_arena::map_file
+    mpw_batch(uint32_t workers = 0, uint64_t memory_budget = 0, const scrypt_options& options = default_options());
+    // Waits for the jobs already running, drops the rest and wipes every key
+    ~mpw_batch(void);
+
+    // Queue a login and return its job number. Name and password are copied, the password is
+    // wiped as soon as the key is done
+    uint32_t        add(const char *name, const char *password);
+    // Block until every job added so far has its key. `progress` is called on this thread with
+    // the percentage over all of them
+    void            wait(progress_func progress = 0);
+
+    uint32_t        get_job_count(void) const;
+    // 0-100, as reported by the job's scrypt
+    uint8_t         get_progress(uint32_t job) const;
+    bool            is_done(uint32_t job) const { return job_at(job).done; }
+    // The job's master key (MASTER_KEY_LEN bytes) or NULL if it isn't done yet
+    const uint8_t * get_master_key(uint32_t job) const;
+    // SCRYPT_WARN_ flags from the job's scrypt, 0 until it's done
+    uint8_t         get_warnings(uint32_t job) const;
+    // Log `mpw` in as the job's user, false if the job isn't done yet
+    bool            login(uint32_t job, MPW& mpw) const;
+
+    uint32_t        get_worker_count(void) const { return m_workers.size(); }
+    // Jobs whose V arrays fit in the budget together
+    uint32_t        get_job_slots(void) const { return m_job_slots; }
+    // Bytes of V array a job holds while it mixes
+    uint64_t        get_job_memory(void) const;
+
+    static scrypt_options default_options(void);
+
+private:
+    struct job
+    {
+        job(void) : name(0), password(0), progress(0), done(false), warnings(0) { memset( master_key, 0, sizeof(master_key) ); }
+        char *                  name;
+        char *                  password;
+        std::atomic<uint8_t>    progress;
+        std::atomic<bool>       done;
+        // Set before `done`, so it's good once that is
+        uint8_t                 warnings;
+        uint8_t                 master_key[MASTER_KEY_LEN];
+    };
+
+    void            worker(void);
+    void            derive(job& j, scrypt<SCRYPT_N, SCRYPT_R, SCRYPT_P, MASTER_KEY_LEN>& holder);
+    const job&      job_at(uint32_t index) const;
+
+private:
+    scrypt_options              m_options;
+    uint32_t                    m_job_slots;
+    std::vector<std::thread>    m_workers;
+    // Jobs never move once added, the workers hold on to them by reference
+    std::deque<job>             m_jobs;
+    uint32_t                    m_next_job;
+    uint32_t                    m_jobs_done;
+    bool                        m_stopping;
+    mutable std::mutex          m_lock;
+    std::condition_variable     m_wake_worker;
+    std::condition_variable     m_job_done;
+};
+
+#endif
+
+#endif
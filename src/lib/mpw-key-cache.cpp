@@ -0,0 +1,191 @@
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Master key session cache
+//
+//  Copyright (C) 2020, Gazoodle (https://github.com/gazoodle)
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "mpw-key-cache.h"
+#include <stdlib.h>
+#include <string.h>
+#ifndef ARDUINO
+#include <chrono>
+#include <random>
+#define MPW_KEY_CACHE_GUARD     std::lock_guard<std::mutex> guard(m_lock)
+#else
+#define MPW_KEY_CACHE_GUARD
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+mpw_key_cache::mpw_key_cache(uint32_t ttl_ms, uint8_t max_entries)
+    : m_ttl_ms(ttl_ms), m_max_entries(0), m_entries(0), m_secret_set(false)
+{
+    set_max_entries(max_entries);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+mpw_key_cache::~mpw_key_cache(void)
+{
+    flush_entries();
+    free(m_entries);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+uint32_t mpw_key_cache::now_ms(void)
+{
+#ifdef ARDUINO
+    return millis();
+#else
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void mpw_key_cache::digest(const char *name, const char *password, uint8_t *digest)
+{
+    MPW_KEY_CACHE_GUARD;
+    // The secret's made up on first use rather than at construction, on Arduino the cache is
+    // likely a global that's built before setup has seeded random
+    if ( !m_secret_set )
+    {
+        uint32_t secret[SHA256::BLOCK_SIZE_BYTES / sizeof(uint32_t)];
+        for(uint8_t i=0; i<countof(secret); i++)
+#ifdef ARDUINO
+            secret[i] = random(0x7fffffff) ^ ( micros() << 16 );
+#else
+            secret[i] = std::random_device()();
+#endif
+        m_secret.set( reinterpret_cast<const uint8_t *>(secret), sizeof(secret) );
+        memset( secret, 0, sizeof(secret) );
+        m_secret_set = true;
+    }
+
+    // The name's length goes first so a name and password can't run into each other
+    uint32_t name_len = strlen(name);
+    HMAC<SHA256> hmac(m_secret);
+    hmac.enqueue_be( name_len );
+    hmac.enqueue( reinterpret_cast<const uint8_t *>(name), name_len );
+    hmac.enqueue( reinterpret_cast<const uint8_t *>(password), strlen(password) );
+    memcpy( digest, hmac.digest(), MPW_KEY_CACHE_DIGEST_LEN );
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool mpw_key_cache::find(const uint8_t *digest, uint8_t *key)
+{
+    MPW_KEY_CACHE_GUARD;
+    expire(now_ms());
+    for(uint8_t i=0; i<m_max_entries; i++)
+    {
+        entry& e = m_entries[i];
+        if ( e.used && ( memcmp( e.digest, digest, MPW_KEY_CACHE_DIGEST_LEN ) == 0 ) )
+        {
+            memcpy( key, e.key, MPW_KEY_CACHE_KEY_LEN );
+            return true;
+        }
+    }
+    return false;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void mpw_key_cache::store(const uint8_t *digest, const uint8_t *key)
+{
+    MPW_KEY_CACHE_GUARD;
+    if ( !is_enabled() )
+        return;
+    uint32_t now = now_ms();
+    expire(now);
+
+    // The entry already there for this digest, else a free one, else the oldest
+    entry * slot = 0;
+    for(uint8_t i=0; ( i<m_max_entries ) && ( slot == 0 ); i++)
+        if ( m_entries[i].used && ( memcmp( m_entries[i].digest, digest, MPW_KEY_CACHE_DIGEST_LEN ) == 0 ) )
+            slot = &m_entries[i];
+    for(uint8_t i=0; ( i<m_max_entries ) && ( slot == 0 ); i++)
+        if ( !m_entries[i].used )
+            slot = &m_entries[i];
+    if ( slot == 0 )
+    {
+        slot = &m_entries[0];
+        for(uint8_t i=1; i<m_max_entries; i++)
+            if ( now - m_entries[i].stored_ms > now - slot->stored_ms )
+                slot = &m_entries[i];
+    }
+    evict(*slot);
+
+    slot->used = true;
+    slot->stored_ms = now;
+    memcpy( slot->digest, digest, MPW_KEY_CACHE_DIGEST_LEN );
+    memcpy( slot->key, key, MPW_KEY_CACHE_KEY_LEN );
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void mpw_key_cache::flush(void)
+{
+    MPW_KEY_CACHE_GUARD;
+    flush_entries();
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+uint8_t mpw_key_cache::get_entry_count(void)
+{
+    MPW_KEY_CACHE_GUARD;
+    expire(now_ms());
+    uint8_t count = 0;
+    for(uint8_t i=0; i<m_max_entries; i++)
+        if ( m_entries[i].used )
+            count++;
+    return count;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void mpw_key_cache::set_ttl(uint32_t ttl_ms)
+{
+    MPW_KEY_CACHE_GUARD;
+    flush_entries();
+    m_ttl_ms = ttl_ms;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void mpw_key_cache::set_max_entries(uint8_t max_entries)
+{
+    MPW_KEY_CACHE_GUARD;
+    flush_entries();
+    free(m_entries);
+    m_entries = 0;
+    m_max_entries = 0;
+    if ( max_entries == 0 )
+        return;
+
+    m_entries = (entry *)calloc(max_entries, sizeof(entry));
+    if ( m_entries == 0 )
+    {
+        IO << F("Failed to allocate master key cache") << endl;
+        empw_exit(EXITCODE_NO_MEMORY);
+    }
+    m_max_entries = max_entries;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void mpw_key_cache::expire(uint32_t now)
+{
+    // Unsigned differences, so the millisecond count wrapping doesn't matter
+    for(uint8_t i=0; i<m_max_entries; i++)
+        if ( m_entries[i].used && ( now - m_entries[i].stored_ms >= m_ttl_ms ) )
+            evict(m_entries[i]);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void mpw_key_cache::evict(entry& e)
+{
+    memset( &e, 0, sizeof(e) );
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void mpw_key_cache::flush_entries(void)
+{
+    for(uint8_t i=0; i<m_max_entries; i++)
+        evict(m_entries[i]);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,107 @@
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  mpw-key-cache.h - Header file for the master key session cache
+//
+//      Every login runs the whole scrypt again, even for a user who logged out a couple of
+//      minutes ago or who is already logged in under another token, and on a Teensy that's
+//      around 30 seconds each time. The cache keeps master keys it has seen for a while so a
+//      login with the same name and password can pick the key straight up. Entries are found
+//      by an HMAC-SHA256 of the name and password under a random secret made up when the
+//      cache is first used, so neither is kept and the digest is no use in another process.
+//      An entry lasts `ttl_ms` from when its key was worked out. When the cache is full the
+//      oldest entry makes way, and every entry is wiped whenever it goes, whether that's
+//      from age, eviction or a flush.
+//
+//  Copyright (C) 2020, Gazoodle (https://github.com/gazoodle)
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef _inc_mpw_key_cache_h
+#define _inc_mpw_key_cache_h
+
+#include <stdint.h>
+#include "sha256.h"
+#include "hmac.h"
+#ifndef ARDUINO
+#include <mutex>
+#endif
+
+#define MPW_KEY_CACHE_KEY_LEN       64
+#define MPW_KEY_CACHE_DIGEST_LEN    SHA256::HASH_SIZE_BYTES
+
+// How long a master key is kept for
+#ifndef MPW_KEY_CACHE_TTL_MS
+#define MPW_KEY_CACHE_TTL_MS        (10 * 60 * 1000)
+#endif
+// Most master keys kept at once
+#ifndef MPW_KEY_CACHE_MAX_ENTRIES
+#define MPW_KEY_CACHE_MAX_ENTRIES   (4)
+#endif
+
+class mpw_key_cache
+{
+private:
+    mpw_key_cache(const mpw_key_cache& other) {}
+public:
+    // A `ttl_ms` or `max_entries` of 0 turns the cache off
+    mpw_key_cache(uint32_t ttl_ms = MPW_KEY_CACHE_TTL_MS, uint8_t max_entries = MPW_KEY_CACHE_MAX_ENTRIES);
+    ~mpw_key_cache(void);
+
+    // What an entry for this name and password is found by
+    void            digest(const char *name, const char *password, uint8_t *digest);
+    // Copy the key for `digest` into `key` (MPW_KEY_CACHE_KEY_LEN bytes), false if there
+    // isn't one or it's expired
+    bool            find(const uint8_t *digest, uint8_t *key);
+    // Keep `key` for `digest`, in place of whatever was there for it before
+    void            store(const uint8_t *digest, const uint8_t *key);
+    // Wipe every entry
+    void            flush(void);
+
+    // Entries still within their TTL
+    uint8_t         get_entry_count(void);
+    uint32_t        get_ttl(void) const { return m_ttl_ms; }
+    uint8_t         get_max_entries(void) const { return m_max_entries; }
+    bool            is_enabled(void) const { return ( m_ttl_ms > 0 ) && ( m_max_entries > 0 ); }
+    // Both of these flush the cache
+    void            set_ttl(uint32_t ttl_ms);
+    void            set_max_entries(uint8_t max_entries);
+
+private:
+    struct entry
+    {
+        bool        used;
+        uint32_t    stored_ms;
+        uint8_t     digest[MPW_KEY_CACHE_DIGEST_LEN];
+        uint8_t     key[MPW_KEY_CACHE_KEY_LEN];
+    };
+
+    static uint32_t now_ms(void);
+    void            expire(uint32_t now);
+    void            evict(entry& e);
+    void            flush_entries(void);
+
+private:
+    uint32_t            m_ttl_ms;
+    uint8_t             m_max_entries;
+    entry *             m_entries;
+    bool                m_secret_set;
+    HMAC_key<SHA256>    m_secret;
+#ifndef ARDUINO
+    std::mutex          m_lock;
+#endif
+};
+
+#endif
@@ -132,14 +132,97 @@ const char * MPW_Template_Class_Characters(char c)
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-MPW& MPW::login(const char *name, const char *password, progress_func progress)
+MPW& MPW::login(const char *name, const char *password, progress_func progress, const scrypt_options& options, const scrypt_cancel_token *cancel)
 {
     // Logout first
     logout();
-    // Gather some reused data
+    // A master key from the cache saves the scrypt altogether
+    if ( cached_login(name, password, progress) )
+        return *this;
+    // Build the salt from the user name
+    uint32_t seed_buffer_len;
+    uint8_t *seed_buffer = create_login_seed(name, seed_buffer_len);
+    // Perform the scrypt algorithm with this seed buffer and the password, output goes to the master key buffer in the class
+    //scrypt_hash( reinterpret_cast<const uint8_t *>(password), strlen(password), seed_buffer, seed_buffer_len );
+    m_master_key_holder.set_options(options);
+    const uint8_t *master_key = m_master_key_holder.hash(reinterpret_cast<const uint8_t *>(password), strlen(password), seed_buffer, seed_buffer_len, progress, cancel);
+    if ( master_key != 0 )
+    {
+        logged_in(master_key);
+        cache_master_key();
+    }
+    // Clean up please
+    free(seed_buffer);
+    // Allow fluent syntax
+    return *this;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+MPW& MPW::login(const uint8_t *master_key)
+{
+    logout();
+    memcpy( m_master_key_copy, master_key, MASTER_KEY_LEN );
+    logged_in(m_master_key_copy);
+    return *this;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void MPW::begin_login(const char *name, const char *password, progress_func progress, const scrypt_options& options)
+{
+    logout();
+    if ( cached_login(name, password, progress) )
+        return;
+    uint32_t seed_buffer_len;
+    uint8_t *seed_buffer = create_login_seed(name, seed_buffer_len);
+    m_master_key_holder.set_options(options);
+    // The scrypt takes its own copy of what it still needs
+    m_master_key_holder.begin(reinterpret_cast<const uint8_t *>(password), strlen(password), seed_buffer, seed_buffer_len, progress);
+    free(seed_buffer);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool MPW::step_login(uint32_t max_blockmix)
+{
+    if ( is_logged_in() )
+        return true;
+    if ( !m_master_key_holder.step(max_blockmix) )
+        return false;
+    logged_in(m_master_key_holder.result());
+    cache_master_key();
+    return true;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool MPW::cached_login(const char *name, const char *password, progress_func progress)
+{
+    static_assert( MASTER_KEY_LEN == MPW_KEY_CACHE_KEY_LEN, "Master key cache entries have to hold a whole master key" );
+    if ( ( m_key_cache == 0 ) || !m_key_cache->is_enabled() )
+        return false;
+    // The digest is kept until the login's done, for the key to be cached under if it misses
+    m_key_cache->digest(name, password, m_cache_digest);
+    m_cache_digest_set = true;
+    if ( !m_key_cache->find(m_cache_digest, m_master_key_copy) )
+        return false;
+    logged_in(m_master_key_copy);
+    if (progress)(progress)(100);
+    return true;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void MPW::cache_master_key(void)
+{
+    if ( ( m_key_cache != 0 ) && m_cache_digest_set )
+        m_key_cache->store(m_cache_digest, m_master_key);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void MPW::logged_in(const uint8_t *master_key)
+{
+    m_master_key = master_key;
+    // Prepare the master key for HMAC once, every site generation then starts from it
+    m_master_key_hmac.set(m_master_key, MASTER_KEY_LEN);
+    generate_login_token();
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+uint8_t* MPW::create_login_seed( const char *name, uint32_t& seed_len )
+{
     uint32_t name_len = strlen(name);
-    uint32_t seed_buffer_len = sizeof(MPW_Namespace) - 1 + sizeof(uint32_t) + name_len;
-    uint8_t *seed_buffer = (uint8_t*)malloc(seed_buffer_len);
+    seed_len = sizeof(MPW_Namespace) - 1 + sizeof(uint32_t) + name_len;
+    uint8_t *seed_buffer = (uint8_t*)malloc(seed_len);
     if ( seed_buffer == 0 )
     {
         IO << F("Failed to allocate seed_buffer for MPW login") << endl;
@@ -149,14 +232,7 @@ MPW& MPW::login(const char *name, const char *password, progress_func progress)
     memcpy( seed_buffer, MPW_Namespace, sizeof(MPW_Namespace)-1);
     push_int( &seed_buffer[sizeof(MPW_Namespace)-1], name_len );
     memcpy( &seed_buffer[sizeof(MPW_Namespace) - 1 + sizeof(uint32_t) ], name, name_len );
-    // Perform the scrypt algorithm with this seed buffer and the password, output goes to the master key buffer in the class
-    //scrypt_hash( reinterpret_cast<const uint8_t *>(password), strlen(password), seed_buffer, seed_buffer_len );
-    m_master_key = m_master_key_holder.hash(reinterpret_cast<const uint8_t *>(password), strlen(password), seed_buffer, seed_buffer_len, progress);
-    // Clean up please
-    free(seed_buffer);
-    generate_login_token();
-    // Allow fluent syntax
-    return *this;
+    return seed_buffer;
 }
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void MPW::logout(void)
@@ -168,7 +244,12 @@ void MPW::logout(void)
     }
 
     m_master_key_holder.Reset();
+    if ( m_master_key == m_master_key_copy )
+        memset( m_master_key_copy, 0, MASTER_KEY_LEN );
     m_master_key = 0;
+    m_master_key_hmac.clear();
+    memset( m_cache_digest, 0, sizeof(m_cache_digest) );
+    m_cache_digest_set = false;
 }
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 const char * MPW::get_password_template( uint8_t c, MPM_Password_Type type )
@@ -229,7 +310,7 @@ const char * MPW::generate( const char *site_name, uint32_t site_counter, MPM_Pa
         memcpy( &seed_buffer[ scope_len + sizeof(uint32_t) + sitename_len + sizeof(uint32_t) + sizeof(uint32_t)], context, context_len );
     }
 
-    HMAC<SHA256> site_key_generator(m_master_key, MASTER_KEY_LEN, seed_buffer, seed_buffer_len);
+    HMAC<SHA256> site_key_generator(m_master_key_hmac, seed_buffer, seed_buffer_len);
     auto site_key = site_key_generator.digest();
 
     if ( type == MPM_Password_Type::Raw )
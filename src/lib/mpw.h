@@ -27,6 +27,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include "scrypt.h"
+#include "mpw-key-cache.h"
 
 #define MASTER_KEY_LEN              64
 #define SCRYPT_N                    32768
@@ -64,24 +65,48 @@ class MPW
 private:
     MPW(const MPW& other){}
 public:
-    MPW(void) : m_master_key(NULL), m_login_token(0), m_site_password(NULL) {}
+    MPW(void) : m_master_key(NULL), m_login_token(0), m_site_password(NULL), m_key_cache(NULL), m_cache_digest_set(false) {}
     ~MPW(void) { logout(); }
 
     // User managment
-    MPW&            login(const char *name, const char *password, progress_func progress);
+    // Cancelling `cancel` part way leaves the user logged out
+    MPW&            login(const char *name, const char *password, progress_func progress, const scrypt_options& options = scrypt_options(), const scrypt_cancel_token *cancel = 0);
+    // Log in with a master key worked out somewhere else (by mpw_batch, say), the MPW keeps a copy
+    MPW&            login(const uint8_t *master_key);
+    // Log in a slice at a time, for callers that can't block for the whole login. begin_login
+    // starts it off, then step_login does about `max_blockmix` BlockMix steps of the scrypt
+    // per call and returns true once the user is logged in
+    void            begin_login(const char *name, const char *password, progress_func progress, const scrypt_options& options = scrypt_options());
+    bool            step_login(uint32_t max_blockmix);
+    // Logins look in `cache` first and leave their master key in it. NULL (the default) for
+    // no cache, the cache has to outlive the MPW
+    void            set_key_cache(mpw_key_cache *cache) { m_key_cache = cache; }
+    mpw_key_cache * get_key_cache(void) const { return m_key_cache; }
     void            logout(void);
     bool            is_logged_in(void) const { return m_master_key != 0; }
     uint32_t        get_login_token(void) const;
+    // SCRYPT_WARN_ flags from the scrypt behind this login, 0 if it came from the cache
+    uint8_t         get_scrypt_warnings(void) const { return m_master_key_holder.get_warnings(); }
+#ifndef ARDUINO
+    // Optional, gets the scrypt memory allocated and paged in before the first login with these options
+    void            prewarm(const scrypt_options& options = scrypt_options()) { m_master_key_holder.set_options(options); m_master_key_holder.prewarm(); }
+#endif
 
     // Generate response
     const char *    generate( const char *site_name, uint32_t site_counter, MPM_Password_Type type, const char * context, const char * scope );
 
+    // The scrypt salt for a user's master key. Caller frees the buffer
+    static uint8_t* create_login_seed( const char *name, uint32_t& seed_len );
+
 private:
     const char *    get_password_template( uint8_t c, MPM_Password_Type type );
     void            generate_login_token(void);
+    void            logged_in(const uint8_t *master_key);
+    bool            cached_login(const char *name, const char *password, progress_func progress);
+    void            cache_master_key(void);
 
 private:
-    void push_int( uint8_t *buf, uint32_t val )
+    static void push_int( uint8_t *buf, uint32_t val )
     {
         buf[0] = val>>24;
         buf[1] = val>>16;
@@ -92,8 +117,13 @@ private:
 private:
     scrypt<SCRYPT_N, SCRYPT_R, SCRYPT_P, MASTER_KEY_LEN>        m_master_key_holder;
     const uint8_t*                                              m_master_key;
+    uint8_t                                                     m_master_key_copy[MASTER_KEY_LEN];
+    HMAC_key<SHA256>                                            m_master_key_hmac;
     uint32_t                                                    m_login_token;
     char *                                                      m_site_password;
+    mpw_key_cache *                                             m_key_cache;
+    uint8_t                                                     m_cache_digest[MPW_KEY_CACHE_DIGEST_LEN];
+    bool                                                        m_cache_digest_set;
 };
 
 
@@ -27,38 +27,203 @@
 template<class HASH_ALGO, uint16_t dkLen>
 PBKDF2<HASH_ALGO, dkLen>::PBKDF2(const uint8_t *password, uint32_t password_len, const uint8_t *salt, uint32_t salt_len, uint32_t c )
 {
-    // Initialize the hash algorithm with the password
-    HASH_ALGO   hash_algorithm(password, password_len);
+    PBKDF2_derive<HASH_ALGO>::derive( password, password_len, salt, salt_len, c, m_key_buffer, dkLen );
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+template<class HASH_ALGO>
+void PBKDF2_derive<HASH_ALGO>::derive(const uint8_t *password, uint32_t password_len, const uint8_t *salt, uint32_t salt_len, uint32_t c, uint8_t *output_buffer, uint32_t output_len)
+{
+    // Initialize the hash algorithm with the password and the salt. The salt is the same
+    // for every output block, so it only gets hashed once here and each block picks up
+    // from this state
+    HASH_ALGO   salted_hash_algorithm(password, password_len);
+    salted_hash_algorithm.enqueue( salt, salt_len );
+    HASH_ALGO   hash_algorithm(salted_hash_algorithm.get_key());
 
-    uint32_t    remainder(dkLen);
     uint8_t     work[HASH_ALGO::HASH_SIZE_BYTES];
     uint8_t     U1[HASH_ALGO::HASH_SIZE_BYTES];
-    uint8_t*    output = m_key_buffer;
+
+    // Let the multi-buffer code have a go first
+    uint32_t    done = PBKDF2_wide<HASH_ALGO>::derive( salted_hash_algorithm, salt, salt_len, c, output_buffer, output_len );
+    uint32_t    remainder(output_len - done);
+    uint8_t*    output = output_buffer + done;
 
     // While there are bytes to be generated
-    for( uint32_t block=1; remainder > 0 ; block++)
+    for( uint32_t block=1 + done / HASH_ALGO::HASH_SIZE_BYTES; remainder > 0 ; block++)
     {
-        hash_algorithm.enqueue( salt, salt_len );
+        hash_algorithm.copy_from( salted_hash_algorithm );
         hash_algorithm.enqueue_be( block );
         memcpy(U1, hash_algorithm.digest(), sizeof(U1));
         memcpy(work, U1, sizeof(U1));
 
-        for( uint32_t i = 1; i < c; i++ )
-        {
-            hash_algorithm.reset();
-            hash_algorithm.enqueue( U1, sizeof(U1));
-            memcpy(U1, hash_algorithm.digest(), sizeof(U1));
-            for( uint8_t j=0; j < sizeof(U1); j++)
-                work[j] ^= U1[j];
-        }
+        PBKDF2_iterator<HASH_ALGO>::iterate( hash_algorithm, U1, work, c );
 
         uint32_t use_len = ( remainder < HASH_ALGO::HASH_SIZE_BYTES ) ? remainder : HASH_ALGO::HASH_SIZE_BYTES;
         memcpy( output, work, use_len );
 
         remainder -= use_len;
         output += use_len;
-
+    }
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+template<class HASH_ALGO>
+void PBKDF2_iterator<HASH_ALGO>::iterate(HASH_ALGO& hash_algorithm, uint8_t *U, uint8_t *work, uint32_t c)
+{
+    for( uint32_t i = 1; i < c; i++ )
+    {
         hash_algorithm.reset();
+        hash_algorithm.enqueue( U, HASH_ALGO::HASH_SIZE_BYTES );
+        memcpy(U, hash_algorithm.digest(), HASH_ALGO::HASH_SIZE_BYTES);
+        for( uint8_t j=0; j < HASH_ALGO::HASH_SIZE_BYTES; j++)
+            work[j] ^= U[j];
     }
 }
 ///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  With HMAC-SHA256 every iteration hashes exactly 32 bytes on top of the padded key, so both
+//  the inner and the outer hash are a single chunk of 8 message words followed by the same
+//  fixed padding. Those chunks are assembled directly from the midstates in the HMAC key and
+//  compressed without any of the byte-wise enqueue/finalize work, and the running U and result
+//  are kept as words so the XOR accumulate is 8 word operations.
+//
+template<>
+inline void PBKDF2_iterator< HMAC<SHA256> >::iterate(HMAC<SHA256>& hash_algorithm, uint8_t *U, uint8_t *work, uint32_t c)
+{
+    // Padding for a 32 byte message following the 64 byte padded key
+    static const uint32_t padding[8] = { 0x80000000, 0, 0, 0, 0, 0, 0, ( SHA256::BLOCK_SIZE_BYTES + SHA256::HASH_SIZE_BYTES ) * 8 };
+
+    const HMAC_key<SHA256>& key = hash_algorithm.get_key();
+    uint32_t    inner_chunk[ SHA256_MESSAGE_SCHEDULE_SIZE ];
+    uint32_t    outer_chunk[ SHA256_MESSAGE_SCHEDULE_SIZE ];
+    uint32_t    hash[ SHA256::STATE_SIZE_WORDS ];
+    uint32_t    accumulator[ SHA256::STATE_SIZE_WORDS ];
+
+    // The previous U goes straight into the first half of the inner chunk
+    for( uint8_t j=0; j < SHA256::STATE_SIZE_WORDS; j++ )
+    {
+        inner_chunk[j] = LOAD_BE32(&U[j*4]);
+        accumulator[j] = inner_chunk[j];
+    }
+
+    for( uint32_t i = 1; i < c; i++ )
+    {
+        // Inner hash of U ...
+        memcpy( &inner_chunk[8], padding, sizeof(padding) );
+        memcpy( hash, key.get_inner_midstate(), sizeof(hash) );
+        SHA256::hash_chunk( hash, inner_chunk );
+        // ... becomes the message of the outer hash ...
+        memcpy( outer_chunk, hash, sizeof(hash) );
+        memcpy( &outer_chunk[8], padding, sizeof(padding) );
+        memcpy( hash, key.get_outer_midstate(), sizeof(hash) );
+        SHA256::hash_chunk( hash, outer_chunk );
+        // ... which is the next U
+        for( uint8_t j=0; j < SHA256::STATE_SIZE_WORDS; j++ )
+        {
+            inner_chunk[j] = hash[j];
+            accumulator[j] ^= hash[j];
+        }
+    }
+
+    for( uint8_t j=0; j < SHA256::STATE_SIZE_WORDS; j++ )
+    {
+        work[j*4+0] = accumulator[j] >> 24;
+        work[j*4+1] = accumulator[j] >> 16;
+        work[j*4+2] = accumulator[j] >> 8;
+        work[j*4+3] = accumulator[j];
+    }
+
+    memset( inner_chunk, 0, sizeof(inner_chunk) );
+    memset( outer_chunk, 0, sizeof(outer_chunk) );
+    memset( hash, 0, sizeof(hash) );
+    memset( accumulator, 0, sizeof(accumulator) );
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+#ifdef EMPW_X86
+//
+//  The output blocks of PBKDF2 are independent of each other, only the block index differs
+//  in the message. With HMAC-SHA256 the whole chunks of the salt are compressed once, then
+//  up to 8 blocks at a time go through the multi-buffer SHA256 with just the salt tail and
+//  their own block index as the message. This is mostly for scrypt's initial PBKDF2 which
+//  produces 64 blocks with c=1.
+//
+#define PBKDF2_WIDE_MIN_BLOCKS      (4)
+
+template<>
+inline uint32_t PBKDF2_wide< HMAC<SHA256> >::derive(const HMAC<SHA256>& hash_algorithm, const uint8_t *salt, uint32_t salt_len, uint32_t c, uint8_t *output, uint32_t output_len)
+{
+    const uint32_t blocks = output_len / SHA256::HASH_SIZE_BYTES;
+    if ( ( blocks < PBKDF2_WIDE_MIN_BLOCKS ) || !cpu_has_avx2() )
+        return 0;
+
+    // Inner hash state after the padded key and the whole chunks of salt
+    const HMAC_key<SHA256>& key = hash_algorithm.get_key();
+    const uint32_t salt_chunks = salt_len & ~(SHA256::BLOCK_SIZE_BYTES-1);
+    const uint32_t tail_len = salt_len - salt_chunks;
+    SHA256 salted;
+    salted.set_midstate( key.get_inner_midstate(), SHA256::BLOCK_SIZE_BYTES );
+    salted.enqueue( salt, salt_chunks );
+
+    uint8_t         tails[SHA256x8::LANES][SHA256::BLOCK_SIZE_BYTES + sizeof(uint32_t)];
+    uint8_t         U[SHA256x8::LANES][SHA256::HASH_SIZE_BYTES];
+    const uint8_t * messages[SHA256x8::LANES];
+    uint32_t        sizes[SHA256x8::LANES];
+    SHA256x8        inner;
+    SHA256x8        outer;
+    HMACx8          iterator(key);
+
+    for( uint32_t block=0; block < blocks; )
+    {
+        uint8_t count = ( blocks - block < SHA256x8::LANES ) ? blocks - block : SHA256x8::LANES;
+
+        // Salt tail || INT(i) for each lane
+        for( uint8_t lane=0; lane < count; lane++ )
+        {
+            uint32_t index = block + lane + 1;
+            memcpy( tails[lane], &salt[salt_chunks], tail_len );
+            tails[lane][tail_len+0] = index >> 24;
+            tails[lane][tail_len+1] = index >> 16;
+            tails[lane][tail_len+2] = index >> 8;
+            tails[lane][tail_len+3] = index;
+            messages[lane] = tails[lane];
+            sizes[lane] = tail_len + sizeof(uint32_t);
+        }
+        inner.hash( count, messages, sizes, salted.get_midstate(), SHA256::BLOCK_SIZE_BYTES + salt_chunks );
+
+        // U1 is the outer hash of those
+        for( uint8_t lane=0; lane < count; lane++ )
+        {
+            messages[lane] = inner.digest(lane);
+            sizes[lane] = SHA256::HASH_SIZE_BYTES;
+        }
+        outer.hash( count, messages, sizes, key.get_outer_midstate(), SHA256::BLOCK_SIZE_BYTES );
+
+        uint8_t * work = &output[ block * SHA256::HASH_SIZE_BYTES ];
+        for( uint8_t lane=0; lane < count; lane++ )
+        {
+            memcpy( &work[ lane * SHA256::HASH_SIZE_BYTES ], outer.digest(lane), SHA256::HASH_SIZE_BYTES );
+            messages[lane] = outer.digest(lane);
+        }
+
+        // Any further iterations run the lanes together too
+        for( uint32_t i = 1; i < c; i++ )
+        {
+            iterator.hash( count, messages, sizes );
+            for( uint8_t lane=0; lane < count; lane++ )
+            {
+                // Hold on to U, the digests get overwritten by the next round
+                memcpy( U[lane], iterator.digest(lane), SHA256::HASH_SIZE_BYTES );
+                messages[lane] = U[lane];
+                for( uint8_t j=0; j < SHA256::HASH_SIZE_BYTES; j++ )
+                    work[ lane * SHA256::HASH_SIZE_BYTES + j ] ^= U[lane][j];
+            }
+        }
+
+        block += count;
+    }
+
+    memset( tails, 0, sizeof(tails) );
+    memset( U, 0, sizeof(U) );
+    return blocks * SHA256::HASH_SIZE_BYTES;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+#endif
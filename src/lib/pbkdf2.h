@@ -23,6 +23,35 @@
 #define _inc_pbkdf2_h
 
 #include <stdint.h>
+#include "sha256.h"
+#include "hmac.h"
+#include "hmacx8.h"
+
+// Runs iterations 2..c of a PBKDF2 block, U is U1 on entry and the block result is
+// accumulated into work. Specialized where the PRF allows something faster.
+template<class HASH_ALGO>
+class PBKDF2_iterator
+{
+public:
+    static void iterate(HASH_ALGO& hash_algorithm, uint8_t *U, uint8_t *work, uint32_t c);
+};
+
+// Produces as many whole output blocks as it can several at a time, returning the number
+// of bytes written. The generic version can't, so the blocks are all done one at a time.
+template<class HASH_ALGO>
+class PBKDF2_wide
+{
+public:
+    static uint32_t derive(const HASH_ALGO& hash_algorithm, const uint8_t *salt, uint32_t salt_len, uint32_t c, uint8_t *output, uint32_t output_len) { return 0; }
+};
+
+// A key of any length into a buffer of the caller's, for when dkLen is only known at runtime
+template<class HASH_ALGO>
+class PBKDF2_derive
+{
+public:
+    static void derive(const uint8_t *password, uint32_t password_len, const uint8_t *salt, uint32_t salt_len, uint32_t c, uint8_t *output, uint32_t output_len);
+};
 
 template<class HASH_ALGO, uint16_t dkLen>
 class PBKDF2
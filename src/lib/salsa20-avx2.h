@@ -0,0 +1,122 @@
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Two lane scrypt BlockMix using AVX2
+//
+//      A single Salsa20/8 chain can't use more than the 128 bits of the diagonal layout (see
+//      salsa20-sse2.h), but two independent chains can share a 256 bit register, one in each
+//      half. The lane rotations between the column and row rounds are in-lane shuffles, so
+//      the SSE2 core carries straight over and both BlockMix calls of a pair of ROMix lanes
+//      cost about the same as one. Blocks are in the same shuffled layout as the SSE2 code.
+//
+//  Copyright (C) 2020, Gazoodle (https://github.com/gazoodle)
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef _inc_salsa20_avx2_h
+#define _inc_salsa20_avx2_h
+
+#include "cpu.h"
+#include "salsa20-sse2.h"
+
+#ifdef EMPW_X86
+
+#define SALSA20_AVX2_ROTL(x, n)     _mm256_or_si256(_mm256_slli_epi32((x), (n)), _mm256_srli_epi32((x), 32-(n)))
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Chunk `index` of a block from each lane, with the matching chunks of `other_a` and `other_b`
+// xored in where they're given
+__attribute__((target("avx2"), always_inline))
+inline __m256i salsa20_avx2_load2(const __m128i * in_a, const __m128i * other_a, const __m128i * in_b, const __m128i * other_b, uint32_t index)
+{
+    return _mm256_inserti128_si256(_mm256_castsi128_si256(salsa20_sse2_load(in_a, other_a, index)), salsa20_sse2_load(in_b, other_b, index), 1);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+__attribute__((target("avx2"), always_inline))
+inline void salsa20_avx2_store2(__m128i * a, __m128i * b, __m256i x)
+{
+    _mm_storeu_si128(a, _mm256_castsi256_si128(x));
+    _mm_storeu_si128(b, _mm256_extracti128_si256(x, 1));
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+__attribute__((target("avx2"), always_inline))
+inline void salsa20_avx2_core8(__m256i& X0, __m256i& X1, __m256i& X2, __m256i& X3)
+{
+    const __m256i Y0 = X0, Y1 = X1, Y2 = X2, Y3 = X3;
+
+    for( uint8_t i=0; i < 8; i += 2 )
+    {
+        X1 = _mm256_xor_si256(X1, SALSA20_AVX2_ROTL(_mm256_add_epi32(X0, X3), 7));
+        X2 = _mm256_xor_si256(X2, SALSA20_AVX2_ROTL(_mm256_add_epi32(X1, X0), 9));
+        X3 = _mm256_xor_si256(X3, SALSA20_AVX2_ROTL(_mm256_add_epi32(X2, X1), 13));
+        X0 = _mm256_xor_si256(X0, SALSA20_AVX2_ROTL(_mm256_add_epi32(X3, X2), 18));
+
+        X1 = _mm256_shuffle_epi32(X1, 0x93);
+        X2 = _mm256_shuffle_epi32(X2, 0x4E);
+        X3 = _mm256_shuffle_epi32(X3, 0x39);
+
+        X3 = _mm256_xor_si256(X3, SALSA20_AVX2_ROTL(_mm256_add_epi32(X0, X1), 7));
+        X2 = _mm256_xor_si256(X2, SALSA20_AVX2_ROTL(_mm256_add_epi32(X3, X0), 9));
+        X1 = _mm256_xor_si256(X1, SALSA20_AVX2_ROTL(_mm256_add_epi32(X2, X3), 13));
+        X0 = _mm256_xor_si256(X0, SALSA20_AVX2_ROTL(_mm256_add_epi32(X1, X2), 18));
+
+        X1 = _mm256_shuffle_epi32(X1, 0x39);
+        X2 = _mm256_shuffle_epi32(X2, 0x4E);
+        X3 = _mm256_shuffle_epi32(X3, 0x93);
+    }
+
+    X0 = _mm256_add_epi32(X0, Y0);
+    X1 = _mm256_add_epi32(X1, Y1);
+    X2 = _mm256_add_epi32(X2, Y2);
+    X3 = _mm256_add_epi32(X3, Y3);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+__attribute__((target("avx2")))
+inline void salsa20_avx2_block_mix_x2(const Salsa20Block * input_a, Salsa20Block * output_a, const Salsa20Block * input_b, Salsa20Block * output_b, uint32_t r,
+                                      const Salsa20Block * other_a = NULL, const Salsa20Block * other_b = NULL)
+{
+    const __m128i * in_a = reinterpret_cast<const __m128i *>(input_a);
+    const __m128i * in_b = reinterpret_cast<const __m128i *>(input_b);
+    const __m128i * xin_a = reinterpret_cast<const __m128i *>(other_a);
+    const __m128i * xin_b = reinterpret_cast<const __m128i *>(other_b);
+    __m128i * out_a = reinterpret_cast<__m128i *>(output_a);
+    __m128i * out_b = reinterpret_cast<__m128i *>(output_b);
+
+    // 1.  X = B[2 * r - 1], lane a in the low half, lane b in the high half
+    __m256i X0 = salsa20_avx2_load2(in_a, xin_a, in_b, xin_b, (2*r-1)*4+0);
+    __m256i X1 = salsa20_avx2_load2(in_a, xin_a, in_b, xin_b, (2*r-1)*4+1);
+    __m256i X2 = salsa20_avx2_load2(in_a, xin_a, in_b, xin_b, (2*r-1)*4+2);
+    __m256i X3 = salsa20_avx2_load2(in_a, xin_a, in_b, xin_b, (2*r-1)*4+3);
+
+    for( uint32_t i=0; i < 2*r; i++ )
+    {
+        X0 = _mm256_xor_si256(X0, salsa20_avx2_load2(in_a, xin_a, in_b, xin_b, i*4+0));
+        X1 = _mm256_xor_si256(X1, salsa20_avx2_load2(in_a, xin_a, in_b, xin_b, i*4+1));
+        X2 = _mm256_xor_si256(X2, salsa20_avx2_load2(in_a, xin_a, in_b, xin_b, i*4+2));
+        X3 = _mm256_xor_si256(X3, salsa20_avx2_load2(in_a, xin_a, in_b, xin_b, i*4+3));
+        salsa20_avx2_core8(X0, X1, X2, X3);
+
+        uint32_t y = ( ( r * (i&1) ) + (i>>1) ) * 4;
+        salsa20_avx2_store2(&out_a[y+0], &out_b[y+0], X0);
+        salsa20_avx2_store2(&out_a[y+1], &out_b[y+1], X1);
+        salsa20_avx2_store2(&out_a[y+2], &out_b[y+2], X2);
+        salsa20_avx2_store2(&out_a[y+3], &out_b[y+3], X3);
+    }
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif
+
+#endif
@@ -0,0 +1,139 @@
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Salsa20/8 core and scrypt BlockMix using SSE2
+//
+//      Each SSE register holds one diagonal of the 4x4 Salsa20 matrix, so a quarter round runs
+//      on all four columns (or rows) at once and moving between the column and row rounds is
+//      just a rotate of the lanes in three of the registers. To get the words into diagonals
+//      with plain aligned loads, blocks are kept in a shuffled order where word i of the
+//      shuffled block is word (i*5)%16 of the original. ROMix shuffles X once on the way in
+//      and back again on the way out, everything in between (including the V array) stays
+//      shuffled. Word 0 doesn't move, so Integerify reads the same word in either layout.
+//
+//  References
+//      https://tools.ietf.org/html/rfc7914
+//      https://github.com/Tarsnap/scrypt/blob/master/lib/crypto/crypto_scrypt_smix_sse2.c
+//
+//  Copyright (C) 2020, Gazoodle (https://github.com/gazoodle)
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef _inc_salsa20_sse2_h
+#define _inc_salsa20_sse2_h
+
+#include "cpu.h"
+#include "salsa20.h"
+
+#ifdef EMPW_X86
+
+#define SALSA20_SSE2_ROTL(x, n)     _mm_or_si128(_mm_slli_epi32((x), (n)), _mm_srli_epi32((x), 32-(n)))
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline void salsa20_sse2_shuffle(Salsa20Block * output, const Salsa20Block * input, uint32_t count)
+{
+    for( uint32_t block=0; block < count; block++ )
+        for( uint8_t i=0; i < SALSA20_ENTRY_COUNT; i++ )
+            output[block].entry[i].as_word32 = input[block].entry[(i*5)%SALSA20_ENTRY_COUNT].as_word32;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline void salsa20_sse2_unshuffle(Salsa20Block * output, const Salsa20Block * input, uint32_t count)
+{
+    for( uint32_t block=0; block < count; block++ )
+        for( uint8_t i=0; i < SALSA20_ENTRY_COUNT; i++ )
+            output[block].entry[(i*5)%SALSA20_ENTRY_COUNT].as_word32 = input[block].entry[i].as_word32;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+__attribute__((always_inline)) inline void salsa20_sse2_core8(__m128i& X0, __m128i& X1, __m128i& X2, __m128i& X3)
+{
+    // X0 = (x0,x5,x10,x15), X1 = (x4,x9,x14,x3), X2 = (x8,x13,x2,x7), X3 = (x12,x1,x6,x11)
+    const __m128i Y0 = X0, Y1 = X1, Y2 = X2, Y3 = X3;
+
+    for( uint8_t i=0; i < 8; i += 2 )
+    {
+        // Column round
+        X1 = _mm_xor_si128(X1, SALSA20_SSE2_ROTL(_mm_add_epi32(X0, X3), 7));
+        X2 = _mm_xor_si128(X2, SALSA20_SSE2_ROTL(_mm_add_epi32(X1, X0), 9));
+        X3 = _mm_xor_si128(X3, SALSA20_SSE2_ROTL(_mm_add_epi32(X2, X1), 13));
+        X0 = _mm_xor_si128(X0, SALSA20_SSE2_ROTL(_mm_add_epi32(X3, X2), 18));
+
+        // Rotate the lanes so the rows line up
+        X1 = _mm_shuffle_epi32(X1, 0x93);
+        X2 = _mm_shuffle_epi32(X2, 0x4E);
+        X3 = _mm_shuffle_epi32(X3, 0x39);
+
+        // Row round
+        X3 = _mm_xor_si128(X3, SALSA20_SSE2_ROTL(_mm_add_epi32(X0, X1), 7));
+        X2 = _mm_xor_si128(X2, SALSA20_SSE2_ROTL(_mm_add_epi32(X3, X0), 9));
+        X1 = _mm_xor_si128(X1, SALSA20_SSE2_ROTL(_mm_add_epi32(X2, X3), 13));
+        X0 = _mm_xor_si128(X0, SALSA20_SSE2_ROTL(_mm_add_epi32(X1, X2), 18));
+
+        // And back to the columns
+        X1 = _mm_shuffle_epi32(X1, 0x39);
+        X2 = _mm_shuffle_epi32(X2, 0x4E);
+        X3 = _mm_shuffle_epi32(X3, 0x93);
+    }
+
+    X0 = _mm_add_epi32(X0, Y0);
+    X1 = _mm_add_epi32(X1, Y1);
+    X2 = _mm_add_epi32(X2, Y2);
+    X3 = _mm_add_epi32(X3, Y3);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Load a 16 byte chunk of a block, with the matching chunk of `other` xored in if there is one
+__attribute__((always_inline)) inline __m128i salsa20_sse2_load(const __m128i * in, const __m128i * other, uint32_t index)
+{
+    __m128i x = _mm_loadu_si128(&in[index]);
+    if ( other != NULL )
+        x = _mm_xor_si128(x, _mm_loadu_si128(&other[index]));
+    return x;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline void salsa20_sse2_block_mix(const Salsa20Block * input, Salsa20Block * output, uint32_t r, const Salsa20Block * other = NULL)
+{
+    // Same as scrypt_mixer::BlockMix, but with shuffled blocks and X held in registers. The
+    // blocks of `other`, if there is one, get xored into the input on the way in
+    const __m128i * in = reinterpret_cast<const __m128i *>(input);
+    const __m128i * xin = reinterpret_cast<const __m128i *>(other);
+    __m128i * out = reinterpret_cast<__m128i *>(output);
+
+    // 1.  X = B[2 * r - 1]
+    __m128i X0 = salsa20_sse2_load(in, xin, (2*r-1)*4+0);
+    __m128i X1 = salsa20_sse2_load(in, xin, (2*r-1)*4+1);
+    __m128i X2 = salsa20_sse2_load(in, xin, (2*r-1)*4+2);
+    __m128i X3 = salsa20_sse2_load(in, xin, (2*r-1)*4+3);
+
+    for( uint32_t i=0; i < 2*r; i++ )
+    {
+        // T = X xor B[i], X = Salsa (T)
+        X0 = _mm_xor_si128(X0, salsa20_sse2_load(in, xin, i*4+0));
+        X1 = _mm_xor_si128(X1, salsa20_sse2_load(in, xin, i*4+1));
+        X2 = _mm_xor_si128(X2, salsa20_sse2_load(in, xin, i*4+2));
+        X3 = _mm_xor_si128(X3, salsa20_sse2_load(in, xin, i*4+3));
+        salsa20_sse2_core8(X0, X1, X2, X3);
+
+        // Even blocks to the first half, odd to the second
+        __m128i * Y = &out[ ( ( r * (i&1) ) + (i>>1) ) * 4 ];
+        _mm_storeu_si128(&Y[0], X0);
+        _mm_storeu_si128(&Y[1], X1);
+        _mm_storeu_si128(&Y[2], X2);
+        _mm_storeu_si128(&Y[3], X3);
+    }
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif
+
+#endif
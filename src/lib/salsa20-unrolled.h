@@ -0,0 +1,145 @@
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Unrolled scalar Salsa20/8 core and scrypt BlockMix
+//
+//      scrypt_mixer::BlockMix follows the RFC step by step, which makes it easy to check but
+//      leaves a lot on the table: Salsa20 copies its block and loops over a runtime round
+//      count, every output block gets a memcpy to a computed index and the caller then copies
+//      T back to X. This version is for targets without the SSE2 code (the Cortex-M7 and
+//      ESP32 builds). The 16 words of the Salsa20 state are locals the compiler can keep in
+//      registers and the rounds are fixed at 8. The 2*r blocks of BlockMix are unrolled at
+//      compile time, so the even/odd output order is just a constant address for each one.
+//      BlockMix can also take a second input that gets xored in as the blocks are read,
+//      which folds phase 2's T = X xor V[j] into the first Salsa20 of each step.
+//
+//  References
+//      https://tools.ietf.org/html/rfc7914
+//      https://cr.yp.to/salsa20.html
+//
+//  Copyright (C) 2020, Gazoodle (https://github.com/gazoodle)
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef _inc_salsa20_unrolled_h
+#define _inc_salsa20_unrolled_h
+
+#include "salsa20.h"
+
+#define SALSA20_UNROLLED_QR(a, b, c, d)     \
+    b ^= RL(a + d, 7);                      \
+    c ^= RL(b + a, 9);                      \
+    d ^= RL(c + b, 13);                     \
+    a ^= RL(d + c, 18);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Y = X xor B [xor C], then Y = Y + Salsa20/8 (Y)
+template<bool xored>
+__attribute__((always_inline)) inline void salsa20_unrolled_core8(const uint32_t * x, const uint32_t * b, const uint32_t * c, uint32_t * y)
+{
+    uint32_t j0  = x[0]  ^ b[0],  j1  = x[1]  ^ b[1],  j2  = x[2]  ^ b[2],  j3  = x[3]  ^ b[3];
+    uint32_t j4  = x[4]  ^ b[4],  j5  = x[5]  ^ b[5],  j6  = x[6]  ^ b[6],  j7  = x[7]  ^ b[7];
+    uint32_t j8  = x[8]  ^ b[8],  j9  = x[9]  ^ b[9],  j10 = x[10] ^ b[10], j11 = x[11] ^ b[11];
+    uint32_t j12 = x[12] ^ b[12], j13 = x[13] ^ b[13], j14 = x[14] ^ b[14], j15 = x[15] ^ b[15];
+    if ( xored )
+    {
+        j0  ^= c[0];  j1  ^= c[1];  j2  ^= c[2];  j3  ^= c[3];
+        j4  ^= c[4];  j5  ^= c[5];  j6  ^= c[6];  j7  ^= c[7];
+        j8  ^= c[8];  j9  ^= c[9];  j10 ^= c[10]; j11 ^= c[11];
+        j12 ^= c[12]; j13 ^= c[13]; j14 ^= c[14]; j15 ^= c[15];
+    }
+
+    uint32_t x0 = j0, x1 = j1, x2  = j2,  x3  = j3,  x4  = j4,  x5  = j5,  x6  = j6,  x7  = j7;
+    uint32_t x8 = j8, x9 = j9, x10 = j10, x11 = j11, x12 = j12, x13 = j13, x14 = j14, x15 = j15;
+
+    for( uint8_t i=0; i < 8; i += 2 )
+    {
+        // Column round
+        SALSA20_UNROLLED_QR(x0,  x4,  x8,  x12)
+        SALSA20_UNROLLED_QR(x5,  x9,  x13, x1)
+        SALSA20_UNROLLED_QR(x10, x14, x2,  x6)
+        SALSA20_UNROLLED_QR(x15, x3,  x7,  x11)
+        // Row round
+        SALSA20_UNROLLED_QR(x0,  x1,  x2,  x3)
+        SALSA20_UNROLLED_QR(x5,  x6,  x7,  x4)
+        SALSA20_UNROLLED_QR(x10, x11, x8,  x9)
+        SALSA20_UNROLLED_QR(x15, x12, x13, x14)
+    }
+
+    y[0]  = x0  + j0;  y[1]  = x1  + j1;  y[2]  = x2  + j2;  y[3]  = x3  + j3;
+    y[4]  = x4  + j4;  y[5]  = x5  + j5;  y[6]  = x6  + j6;  y[7]  = x7  + j7;
+    y[8]  = x8  + j8;  y[9]  = x9  + j9;  y[10] = x10 + j10; y[11] = x11 + j11;
+    y[12] = x12 + j12; y[13] = x13 + j13; y[14] = x14 + j14; y[15] = x15 + j15;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Step i of BlockMix, followed by all the ones after it. X is the output of the previous step,
+// which is already sitting in the output array, so nothing gets copied about
+template<uint32_t r, bool xored, uint32_t i, bool done = ( i == 2*r )>
+struct salsa20_unrolled_step
+{
+    __attribute__((always_inline)) static inline void run(const uint32_t * X, const Salsa20Block * input, const Salsa20Block * other, Salsa20Block * output)
+    {
+        uint32_t * Y = &output[ ( r * (i&1) ) + (i>>1) ].entry[0].as_word32;
+        salsa20_unrolled_core8<xored>(X, &input[i].entry[0].as_word32, xored ? &other[i].entry[0].as_word32 : NULL, Y);
+        salsa20_unrolled_step<r, xored, i+1>::run(Y, input, other, output);
+    }
+};
+template<uint32_t r, bool xored, uint32_t i>
+struct salsa20_unrolled_step<r, xored, i, true>
+{
+    __attribute__((always_inline)) static inline void run(const uint32_t * X, const Salsa20Block * input, const Salsa20Block * other, Salsa20Block * output) {}
+};
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Same as scrypt_mixer::BlockMix, with the blocks of `other` (if there is one) xored into the
+// input as it goes. Output can't be either of the inputs
+template<uint32_t r>
+inline void salsa20_unrolled_block_mix(const Salsa20Block * input, Salsa20Block * output, const Salsa20Block * other = NULL)
+{
+    // 1.  X = B[2 * r - 1]
+    uint32_t X[SALSA20_ENTRY_COUNT];
+    for( uint8_t k=0; k < SALSA20_ENTRY_COUNT; k++ )
+        X[k] = input[2*r-1].entry[k].as_word32 ^ ( ( other != NULL ) ? other[2*r-1].entry[k].as_word32 : 0 );
+
+    // 2. & 3. with the output order folded into where each step writes, and the check for
+    // `other` done once here rather than for every block
+    if ( other != NULL )
+        salsa20_unrolled_step<r, true, 0>::run(X, input, other, output);
+    else
+        salsa20_unrolled_step<r, false, 0>::run(X, input, other, output);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// The same again for an r that's only known at runtime. Only the Salsa20 core is unrolled,
+// each block goes to its place in the output through a computed index
+inline void salsa20_unrolled_block_mix(const Salsa20Block * input, Salsa20Block * output, uint32_t r, const Salsa20Block * other = NULL)
+{
+    // 1.  X = B[2 * r - 1]
+    uint32_t X[SALSA20_ENTRY_COUNT];
+    for( uint8_t k=0; k < SALSA20_ENTRY_COUNT; k++ )
+        X[k] = input[2*r-1].entry[k].as_word32 ^ ( ( other != NULL ) ? other[2*r-1].entry[k].as_word32 : 0 );
+
+    const uint32_t * x = X;
+    for( uint32_t i=0; i < 2*r; i++ )
+    {
+        uint32_t * Y = &output[ ( r * (i&1) ) + (i>>1) ].entry[0].as_word32;
+        if ( other != NULL )
+            salsa20_unrolled_core8<true>(x, &input[i].entry[0].as_word32, &other[i].entry[0].as_word32, Y);
+        else
+            salsa20_unrolled_core8<false>(x, &input[i].entry[0].as_word32, NULL, Y);
+        x = Y;
+    }
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif
@@ -0,0 +1,249 @@
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  salsa20x8.h - Header file for multi-buffer Salsa20/8 and scrypt BlockMix
+//
+//      Runs the BlockMix of up to eight independent scrypt calculations at once, the same way
+//      SHA256x8 does for SHA256. The blocks are transposed so word w of every lane sits in one
+//      vector, and the Salsa20 rounds work on all the lanes without any of the lane rotations
+//      the single block SSE2 code needs. On x86 hosts with AVX2 all eight lanes go in one
+//      pass, otherwise SSE2 does them four at a time. Elsewhere the lanes just run one after
+//      another through the same code with plain 32 bit words.
+//
+//  References
+//      https://tools.ietf.org/html/rfc7914
+//      https://www.intel.com/content/dam/www/public/us/en/documents/white-papers/communications-ia-multi-buffer-paper.pdf
+//
+//  Copyright (C) 2020, Gazoodle (https://github.com/gazoodle)
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef _inc_salsa20x8_h
+#define _inc_salsa20x8_h
+
+#include "salsa20.h"
+#include "cpu.h"
+
+#define SALSA20X8_LANES     8
+
+// A Salsa20 block for each lane, lane n of word w in word[w][n]
+struct Salsa20BlockX8
+{
+    uint32_t    word[SALSA20_ENTRY_COUNT][SALSA20X8_LANES];
+
+    // Lane `lane` to and from an ordinary block
+    inline void set_lane(uint8_t lane, const Salsa20Block& block)
+    {
+        for(uint8_t w=0; w<SALSA20_ENTRY_COUNT; w++)
+            word[w][lane] = block.entry[w].as_word32;
+    }
+    inline void get_lane(uint8_t lane, Salsa20Block& block) const
+    {
+        for(uint8_t w=0; w<SALSA20_ENTRY_COUNT; w++)
+            block.entry[w].as_word32 = word[w][lane];
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// The same BlockMix as scrypt_mixer::BlockMix, except every word is a vector with one lane per
+// calculation. With `other` given, its blocks get xored into the input as it's read. Works on
+// the lanes from `first_lane` on, as many as fit in V
+template<class V>
+__attribute__((always_inline)) inline void salsa20xN_block_mix(const Salsa20BlockX8 * input, Salsa20BlockX8 * output, uint32_t r, const Salsa20BlockX8 * other, uint8_t first_lane)
+{
+    V x[SALSA20_ENTRY_COUNT];
+    V j[SALSA20_ENTRY_COUNT];
+
+    // 1.  X = B[2 * r - 1]
+    for(uint8_t w=0; w<SALSA20_ENTRY_COUNT; w++)
+    {
+        memcpy( &x[w], &input[2*r-1].word[w][first_lane], sizeof(V) );
+        if ( other != NULL )
+        {
+            V o;
+            memcpy( &o, &other[2*r-1].word[w][first_lane], sizeof(V) );
+            x[w] ^= o;
+        }
+    }
+
+    for(uint32_t i=0; i<2*r; i++)
+    {
+        // T = X xor B[i]
+        for(uint8_t w=0; w<SALSA20_ENTRY_COUNT; w++)
+        {
+            V b;
+            memcpy( &b, &input[i].word[w][first_lane], sizeof(V) );
+            if ( other != NULL )
+            {
+                V o;
+                memcpy( &o, &other[i].word[w][first_lane], sizeof(V) );
+                b ^= o;
+            }
+            j[w] = x[w] ^= b;
+        }
+
+        // X = Salsa (T)
+        for(uint8_t round=0; round<8; round+=2)
+        {
+            x[ 4] ^= RL(x[ 0]+x[12], 7);  x[ 8] ^= RL(x[ 4]+x[ 0], 9);  x[12] ^= RL(x[ 8]+x[ 4],13);  x[ 0] ^= RL(x[12]+x[ 8],18);
+            x[ 9] ^= RL(x[ 5]+x[ 1], 7);  x[13] ^= RL(x[ 9]+x[ 5], 9);  x[ 1] ^= RL(x[13]+x[ 9],13);  x[ 5] ^= RL(x[ 1]+x[13],18);
+            x[14] ^= RL(x[10]+x[ 6], 7);  x[ 2] ^= RL(x[14]+x[10], 9);  x[ 6] ^= RL(x[ 2]+x[14],13);  x[10] ^= RL(x[ 6]+x[ 2],18);
+            x[ 3] ^= RL(x[15]+x[11], 7);  x[ 7] ^= RL(x[ 3]+x[15], 9);  x[11] ^= RL(x[ 7]+x[ 3],13);  x[15] ^= RL(x[11]+x[ 7],18);
+
+            x[ 1] ^= RL(x[ 0]+x[ 3], 7);  x[ 2] ^= RL(x[ 1]+x[ 0], 9);  x[ 3] ^= RL(x[ 2]+x[ 1],13);  x[ 0] ^= RL(x[ 3]+x[ 2],18);
+            x[ 6] ^= RL(x[ 5]+x[ 4], 7);  x[ 7] ^= RL(x[ 6]+x[ 5], 9);  x[ 4] ^= RL(x[ 7]+x[ 6],13);  x[ 5] ^= RL(x[ 4]+x[ 7],18);
+            x[11] ^= RL(x[10]+x[ 9], 7);  x[ 8] ^= RL(x[11]+x[10], 9);  x[ 9] ^= RL(x[ 8]+x[11],13);  x[10] ^= RL(x[ 9]+x[ 8],18);
+            x[12] ^= RL(x[15]+x[14], 7);  x[13] ^= RL(x[12]+x[15], 9);  x[14] ^= RL(x[13]+x[12],13);  x[15] ^= RL(x[14]+x[13],18);
+        }
+
+        // Even blocks to the first half, odd to the second
+        Salsa20BlockX8 * Y = &output[ ( r * (i&1) ) + (i>>1) ];
+        for(uint8_t w=0; w<SALSA20_ENTRY_COUNT; w++)
+        {
+            x[w] += j[w];
+            memcpy( &Y->word[w][first_lane], &x[w], sizeof(V) );
+        }
+    }
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline void salsa20x8_block_mix_portable(const Salsa20BlockX8 * input, Salsa20BlockX8 * output, uint32_t r, const Salsa20BlockX8 * other)
+{
+    for(uint8_t lane=0; lane<SALSA20X8_LANES; lane++)
+        salsa20xN_block_mix<uint32_t>(input, output, r, other, lane);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+#ifdef EMPW_X86
+
+typedef uint32_t salsa20_u32x4 __attribute__((vector_size(16)));
+typedef uint32_t salsa20_u32x8 __attribute__((vector_size(32)));
+
+inline void salsa20x8_block_mix_sse2(const Salsa20BlockX8 * input, Salsa20BlockX8 * output, uint32_t r, const Salsa20BlockX8 * other)
+{
+    salsa20xN_block_mix<salsa20_u32x4>(input, output, r, other, 0);
+    salsa20xN_block_mix<salsa20_u32x4>(input, output, r, other, 4);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+__attribute__((target("avx2")))
+inline void salsa20x8_block_mix_avx2(const Salsa20BlockX8 * input, Salsa20BlockX8 * output, uint32_t r, const Salsa20BlockX8 * other)
+{
+    salsa20xN_block_mix<salsa20_u32x8>(input, output, r, other, 0);
+}
+
+#endif
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Moving `count` whole blocks between the transposed layout and a separate array per lane. The
+// portable versions go a word at a time, AVX2 turns the 8x8 word squares round in registers
+inline void salsa20x8_get_lanes_portable(const Salsa20BlockX8 * x, Salsa20Block * const * lanes, uint32_t count)
+{
+    for(uint8_t lane=0; lane<SALSA20X8_LANES; lane++)
+        for(uint32_t b=0; b<count; b++)
+            x[b].get_lane(lane, lanes[lane][b]);
+}
+inline void salsa20x8_set_lanes_portable(Salsa20BlockX8 * x, const Salsa20Block * const * lanes, uint32_t count)
+{
+    for(uint8_t lane=0; lane<SALSA20X8_LANES; lane++)
+        for(uint32_t b=0; b<count; b++)
+            x[b].set_lane(lane, lanes[lane][b]);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+#ifdef EMPW_X86
+// Rows become columns
+__attribute__((target("avx2"), always_inline))
+inline void salsa20x8_transpose_avx2(__m256i& r0, __m256i& r1, __m256i& r2, __m256i& r3, __m256i& r4, __m256i& r5, __m256i& r6, __m256i& r7)
+{
+    __m256i t0 = _mm256_unpacklo_epi32(r0, r1), t1 = _mm256_unpackhi_epi32(r0, r1);
+    __m256i t2 = _mm256_unpacklo_epi32(r2, r3), t3 = _mm256_unpackhi_epi32(r2, r3);
+    __m256i t4 = _mm256_unpacklo_epi32(r4, r5), t5 = _mm256_unpackhi_epi32(r4, r5);
+    __m256i t6 = _mm256_unpacklo_epi32(r6, r7), t7 = _mm256_unpackhi_epi32(r6, r7);
+    __m256i u0 = _mm256_unpacklo_epi64(t0, t2), u1 = _mm256_unpackhi_epi64(t0, t2);
+    __m256i u2 = _mm256_unpacklo_epi64(t1, t3), u3 = _mm256_unpackhi_epi64(t1, t3);
+    __m256i u4 = _mm256_unpacklo_epi64(t4, t6), u5 = _mm256_unpackhi_epi64(t4, t6);
+    __m256i u6 = _mm256_unpacklo_epi64(t5, t7), u7 = _mm256_unpackhi_epi64(t5, t7);
+    r0 = _mm256_permute2x128_si256(u0, u4, 0x20); r4 = _mm256_permute2x128_si256(u0, u4, 0x31);
+    r1 = _mm256_permute2x128_si256(u1, u5, 0x20); r5 = _mm256_permute2x128_si256(u1, u5, 0x31);
+    r2 = _mm256_permute2x128_si256(u2, u6, 0x20); r6 = _mm256_permute2x128_si256(u2, u6, 0x31);
+    r3 = _mm256_permute2x128_si256(u3, u7, 0x20); r7 = _mm256_permute2x128_si256(u3, u7, 0x31);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+__attribute__((target("avx2")))
+inline void salsa20x8_get_lanes_avx2(const Salsa20BlockX8 * x, Salsa20Block * const * lanes, uint32_t count)
+{
+    for(uint32_t b=0; b<count; b++)
+        for(uint8_t half=0; half<SALSA20_ENTRY_COUNT; half+=8)
+        {
+            __m256i r[8];
+            for(uint8_t i=0; i<8; i++)
+                r[i] = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(x[b].word[half+i]));
+            salsa20x8_transpose_avx2(r[0], r[1], r[2], r[3], r[4], r[5], r[6], r[7]);
+            for(uint8_t lane=0; lane<8; lane++)
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(&lanes[lane][b].entry[half]), r[lane]);
+        }
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+__attribute__((target("avx2")))
+inline void salsa20x8_set_lanes_avx2(Salsa20BlockX8 * x, const Salsa20Block * const * lanes, uint32_t count)
+{
+    for(uint32_t b=0; b<count; b++)
+        for(uint8_t half=0; half<SALSA20_ENTRY_COUNT; half+=8)
+        {
+            __m256i r[8];
+            for(uint8_t lane=0; lane<8; lane++)
+                r[lane] = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&lanes[lane][b].entry[half]));
+            salsa20x8_transpose_avx2(r[0], r[1], r[2], r[3], r[4], r[5], r[6], r[7]);
+            for(uint8_t i=0; i<8; i++)
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(x[b].word[half+i]), r[i]);
+        }
+}
+#endif
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Block b of lane n goes to, or comes from, lanes[n][b]
+inline void salsa20x8_get_lanes(const Salsa20BlockX8 * x, Salsa20Block * const * lanes, uint32_t count)
+{
+#ifdef EMPW_X86
+    if ( cpu_has_avx2() )
+    {
+        salsa20x8_get_lanes_avx2(x, lanes, count);
+        return;
+    }
+#endif
+    salsa20x8_get_lanes_portable(x, lanes, count);
+}
+inline void salsa20x8_set_lanes(Salsa20BlockX8 * x, const Salsa20Block * const * lanes, uint32_t count)
+{
+#ifdef EMPW_X86
+    if ( cpu_has_avx2() )
+    {
+        salsa20x8_set_lanes_avx2(x, lanes, count);
+        return;
+    }
+#endif
+    salsa20x8_set_lanes_portable(x, lanes, count);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// BlockMix for all the lanes at once, whichever way is quickest here
+inline void salsa20x8_block_mix(const Salsa20BlockX8 * input, Salsa20BlockX8 * output, uint32_t r, const Salsa20BlockX8 * other = NULL)
+{
+#ifdef EMPW_X86
+    if ( cpu_has_avx2() )
+        salsa20x8_block_mix_avx2(input, output, r, other);
+    else
+        salsa20x8_block_mix_sse2(input, output, r, other);
+#else
+    salsa20x8_block_mix_portable(input, output, r, other);
+#endif
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif
@@ -0,0 +1,200 @@
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Reusable scrypt V array arena implementation
+//
+//  Copyright (C) 2020, Gazoodle (https://github.com/gazoodle)
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline uint8_t scrypt_arena::do_prewarm(uint32_t size, uint8_t count)
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+
+    uint8_t have = 0;
+    for(uint8_t i=0; i<SCRYPT_ARENA_MAX_CHUNKS; i++)
+        if ( ( m_chunks[i].buffer != NULL ) && ( m_chunks[i].size >= size ) )
+            have++;
+
+    for(uint8_t i=0; ( i<SCRYPT_ARENA_MAX_CHUNKS ) && ( have < count ); i++)
+    {
+        if ( m_chunks[i].buffer != NULL )
+            continue;
+        void * buffer = map(size);
+        if ( buffer == NULL )
+            break;
+        // Writing every page is what gets them faulted in now rather than during a login. The
+        // writes are volatile, otherwise the compiler turns malloc and a memset of 0 into calloc,
+        // which doesn't touch anything
+        volatile uint8_t * page = reinterpret_cast<volatile uint8_t *>(buffer);
+        for(uint32_t offset=0; offset < size; offset += SCRYPT_ARENA_PAGE_SIZE)
+            page[offset] = 0;
+        m_chunks[i].buffer = buffer;
+        m_chunks[i].size = size;
+        m_chunks[i].in_use = false;
+        have++;
+    }
+
+    return have;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline void * scrypt_arena::do_borrow(uint32_t size)
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+
+    for(uint8_t i=0; i<SCRYPT_ARENA_MAX_CHUNKS; i++)
+    {
+        if ( ( m_chunks[i].buffer != NULL ) && !m_chunks[i].in_use && ( m_chunks[i].size >= size ) )
+        {
+            m_chunks[i].in_use = true;
+            return m_chunks[i].buffer;
+        }
+    }
+    return NULL;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline bool scrypt_arena::do_give_back(void * buffer)
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+
+    for(uint8_t i=0; i<SCRYPT_ARENA_MAX_CHUNKS; i++)
+    {
+        if ( ( buffer != NULL ) && ( m_chunks[i].buffer == buffer ) )
+        {
+            memset( m_chunks[i].buffer, 0, m_chunks[i].size );
+            m_chunks[i].in_use = false;
+            return true;
+        }
+    }
+    return false;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline void scrypt_arena::do_release(void)
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+
+    for(uint8_t i=0; i<SCRYPT_ARENA_MAX_CHUNKS; i++)
+    {
+        if ( ( m_chunks[i].buffer != NULL ) && !m_chunks[i].in_use )
+        {
+            memset( m_chunks[i].buffer, 0, m_chunks[i].size );
+            unmap( m_chunks[i].buffer, m_chunks[i].size );
+            m_chunks[i].buffer = NULL;
+        }
+    }
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline void * scrypt_arena::map(uint32_t size)
+{
+#ifdef __linux__
+    size_t mapped_size = ( (size_t)size + SCRYPT_ARENA_HUGE_PAGE_SIZE - 1 ) & ~(size_t)( SCRYPT_ARENA_HUGE_PAGE_SIZE - 1 );
+
+#ifdef MAP_HUGETLB
+    // Explicit huge pages only work if the admin has reserved some, which is rare
+    if ( get_huge_pages() )
+    {
+        void * buffer = mmap( NULL, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+        if ( buffer != MAP_FAILED )
+            return buffer;
+    }
+#endif
+
+    // Map an extra huge page worth so there's an aligned run of the right size somewhere
+    // inside, then trim off the ends. Alignment is what lets the kernel use huge pages for it
+    size_t span = mapped_size + SCRYPT_ARENA_HUGE_PAGE_SIZE;
+    uint8_t * raw = (uint8_t *)mmap( NULL, span, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if ( (void *)raw == MAP_FAILED )
+        return NULL;
+    uint8_t * aligned = (uint8_t *)( ( (uintptr_t)raw + SCRYPT_ARENA_HUGE_PAGE_SIZE - 1 ) & ~(uintptr_t)( SCRYPT_ARENA_HUGE_PAGE_SIZE - 1 ) );
+    if ( aligned > raw )
+        munmap( raw, aligned - raw );
+    if ( raw + span > aligned + mapped_size )
+        munmap( aligned + mapped_size, ( raw + span ) - ( aligned + mapped_size ) );
+
+#ifdef MADV_HUGEPAGE
+    madvise( aligned, mapped_size, get_huge_pages() ? MADV_HUGEPAGE : MADV_NOHUGEPAGE );
+#endif
+    return aligned;
+#else
+    return malloc(size);
+#endif
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline void scrypt_arena::unmap(void * buffer, uint32_t size)
+{
+#ifdef __linux__
+    size_t mapped_size = ( (size_t)size + SCRYPT_ARENA_HUGE_PAGE_SIZE - 1 ) & ~(size_t)( SCRYPT_ARENA_HUGE_PAGE_SIZE - 1 );
+    munmap( buffer, mapped_size );
+#else
+    free(buffer);
+#endif
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline void * scrypt_arena::map_file(const char * path, uint32_t size)
+{
+#ifdef __linux__
+    int fd = -1;
+    struct stat info;
+    if ( ( path == NULL ) || ( *path == 0 ) )
+        fd = memfd_create( "empw-scrypt-v", MFD_CLOEXEC );
+    else if ( ( stat( path, &info ) == 0 ) && S_ISDIR( info.st_mode ) )
+        fd = open( path, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600 );
+    else
+    {
+        // Every hash gets a file of its own next to `path`, never `path` itself. Sharing one
+        // would have concurrent hashes mixing in each other's V, and whatever was already at
+        // `path` is the user's. The name goes straight away, the descriptor keeps it alive
+        size_t path_len = strlen( path );
+        char * name = (char *)malloc( path_len + 8 );
+        if ( name == NULL )
+            return NULL;
+        memcpy( name, path, path_len );
+        memcpy( name + path_len, ".XXXXXX", 8 );
+        fd = mkostemp( name, O_CLOEXEC );
+        if ( fd >= 0 )
+            unlink( name );
+        free( name );
+    }
+    if ( fd < 0 )
+        return NULL;
+
+    // The file's always new and empty, so just size it
+    void * buffer = NULL;
+    if ( ftruncate( fd, size ) == 0 )
+    {
+        buffer = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+        if ( buffer == MAP_FAILED )
+            buffer = NULL;
+    }
+    // The mapping holds its own reference to the file
+    close( fd );
+
+    // Phase 2 of ROMix reads V all over the place, read ahead would just be wasted IO
+    if ( buffer != NULL )
+        madvise( buffer, size, MADV_RANDOM );
+    return buffer;
+#else
+    return NULL;
+#endif
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline void scrypt_arena::unmap_file(void * buffer, uint32_t size)
+{
+#ifdef __linux__
+    // The file's gone by now, but its blocks may not be, so don't leave password derived data in them
+    memset( buffer, 0, size );
+    munmap( buffer, size );
+#endif
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
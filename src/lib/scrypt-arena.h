@@ -0,0 +1,132 @@
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  scrypt-arena.h - Header file for the reusable scrypt V array arena
+//
+//      On a host the ROMix V array is a fully populated 32MB heap buffer, and getting a fresh
+//      one from malloc on every login means page faulting all of it in again during the first
+//      phase of ROMix. The arena holds on to a few V sized buffers for the life of the process.
+//      Mixers borrow one if there's a free one big enough and hand it back afterwards, falling
+//      back to malloc otherwise. Buffers only get into the arena through prewarm, which also
+//      touches every page so the first login starts on resident memory. Buffers are wiped when
+//      they come back since they've been holding password derived data.
+//
+//      It also maps files (or anonymous memfds) for the global V tier on Linux. That's the host
+//      equivalent of the PSRAM a Teensy 4.1 can have, RAM can be kept for the heap tier and the
+//      rest of V goes to tmpfs or a fast disk.
+//
+//      V arrays are mapped straight from the OS rather than coming from malloc. Phase 2 of ROMix
+//      reads the array at random, so with 4KB pages nearly every V[j] is a TLB miss as well as
+//      a cache miss. On Linux the mapping asks for explicit 2MB huge pages first, then falls
+//      back to an aligned normal mapping advised for transparent huge pages, which the kernel
+//      is free to ignore. Elsewhere it's just malloc.
+//
+//      Embedded builds don't have the memory to keep anything hanging around, so there's no
+//      arena there.
+//
+//  Copyright (C) 2020, Gazoodle (https://github.com/gazoodle)
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef _inc_scrypt_arena_h
+#define _inc_scrypt_arena_h
+
+#ifndef ARDUINO
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mutex>
+#include <atomic>
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Enough for a V array per lane of a full scrypt_batch. Only prewarm puts buffers in the
+// arena, so this costs nothing unless they're asked for
+#define SCRYPT_ARENA_MAX_CHUNKS     (8)
+
+// Smallest page size we're likely to meet, prewarm writes a byte at least this often
+#define SCRYPT_ARENA_PAGE_SIZE      (4096)
+// Huge page size V arrays get rounded up and aligned to
+#define SCRYPT_ARENA_HUGE_PAGE_SIZE (2*1024*1024)
+
+class scrypt_arena
+{
+private:
+    scrypt_arena(const scrypt_arena& other) {}
+    scrypt_arena(void) : m_huge_pages(true) { memset(m_chunks, 0, sizeof(m_chunks)); }
+public:
+    ~scrypt_arena(void) { release(); }
+
+    // Make sure the arena holds at least `count` buffers of `size` bytes, all paged in.
+    // Returns the number of buffers of that size it now has
+    static uint8_t prewarm(uint32_t size, uint8_t count) { return instance().do_prewarm(size, count); }
+    // A free buffer of at least `size` bytes, or NULL if there isn't one
+    static void * borrow(uint32_t size) { return instance().do_borrow(size); }
+    // Returns false if the buffer didn't come from the arena
+    static bool give_back(void * buffer) { return instance().do_give_back(buffer); }
+    // Free every buffer that isn't currently borrowed
+    static void release(void) { instance().do_release(); }
+
+    // Memory for a V array of `size` bytes from the OS, NULL if there isn't any
+    static void * map(uint32_t size);
+    // Give back memory that came from map, `size` as passed to map
+    static void unmap(void * buffer, uint32_t size);
+    // `size` bytes of a new private file mapped in, for random access. A directory gets an
+    // unnamed temporary file in it, any other path a file named after it with a random
+    // suffix that's removed as soon as it's made, no path at all an anonymous memfd. Each call
+    // has a file of its own and any file already at `path` is left alone. NULL if it can't
+    // be done, which is always the case off Linux
+    static void * map_file(const char * path, uint32_t size);
+    // Wipe and give back memory that came from map_file
+    static void unmap_file(void * buffer, uint32_t size);
+    // Huge pages are used by default, this is mostly for benchmarking without them
+    static void set_huge_pages(bool enable) { instance().m_huge_pages = enable; }
+    static bool get_huge_pages(void) { return instance().m_huge_pages; }
+
+private:
+    static scrypt_arena& instance(void)
+    {
+        static scrypt_arena arena;
+        return arena;
+    }
+
+    uint8_t do_prewarm(uint32_t size, uint8_t count);
+    void *  do_borrow(uint32_t size);
+    bool    do_give_back(void * buffer);
+    void    do_release(void);
+
+private:
+    struct chunk
+    {
+        void *      buffer;
+        uint32_t    size;
+        bool        in_use;
+    };
+
+    std::mutex          m_lock;
+    chunk               m_chunks[SCRYPT_ARENA_MAX_CHUNKS];
+    std::atomic<bool>   m_huge_pages;
+};
+
+#include "scrypt-arena-impl.h"
+
+#endif
+
+#endif
@@ -0,0 +1,156 @@
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Multi-buffer scrypt implementation
+//
+//  References
+//      https://tools.ietf.org/html/rfc7914
+//
+//  Copyright (C) 2020, Gazoodle (https://github.com/gazoodle)
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+template<uint32_t N, uint32_t r, uint32_t p, uint32_t dkLen>
+bool scrypt_batch<N,r,p,dkLen>::hash(uint8_t count, const uint8_t * const * passphrases, const uint32_t * passphrase_sizes, const uint8_t * const * salts, const uint32_t * salt_sizes, progress_func progress)
+{
+    const uint32_t mix_size = p * 128 * r;
+    const uint32_t v_size = N * r * 2 * sizeof(Salsa20Block);
+    if ( ( count == 0 ) || ( count > LANES ) )
+        return false;
+
+    // A whole V array for every lane, and somewhere to keep each lane's B between the PBKDF2s
+    Salsa20Block * V[LANES];
+    bool have_memory = true;
+    for(uint8_t lane=0; lane<count; lane++)
+    {
+        V[lane] = (Salsa20Block*)scrypt_arena::borrow(v_size);
+        if ( V[lane] == 0 )
+            V[lane] = (Salsa20Block*)scrypt_arena::map(v_size);
+        have_memory = have_memory && ( V[lane] != 0 );
+    }
+    uint8_t * blocks = (uint8_t*)malloc( count * mix_size );
+    have_memory = have_memory && ( blocks != 0 );
+
+    if ( have_memory )
+    {
+        if (progress)(progress)(0);
+
+        // Initialize working areas, generating expensive salts
+        for(uint8_t lane=0; lane<count; lane++)
+        {
+            PBKDF2<HMAC<SHA256>,mix_size> initial(passphrases[lane], passphrase_sizes[lane], salts[lane], salt_sizes[lane], 1);
+            memcpy( &blocks[lane*mix_size], initial.result(), mix_size );
+        }
+
+        // Mix each of the p blocks of all the calculations together. Lanes beyond count just
+        // mix zeros and never touch a V array
+        memset( X, 0, sizeof(X) );
+        for(uint32_t i=0; i<p; i++)
+        {
+            for(uint8_t lane=0; lane<count; lane++)
+            {
+                const Salsa20Block * B = reinterpret_cast<const Salsa20Block*>(&blocks[lane*mix_size]) + i*r*2;
+                for(uint32_t b=0; b<r*2; b++)
+                    X[b].set_lane(lane, B[b]);
+            }
+            ROMix(count, V, [&] ( uint8_t percent ) {
+                if (progress)(progress)( ( i * 100 / p ) + ( percent / p ) );
+            });
+            for(uint8_t lane=0; lane<count; lane++)
+            {
+                Salsa20Block * B = reinterpret_cast<Salsa20Block*>(&blocks[lane*mix_size]) + i*r*2;
+                for(uint32_t b=0; b<r*2; b++)
+                    X[b].get_lane(lane, B[b]);
+            }
+        }
+
+        // Do final hashes on the second salts
+        for(uint8_t lane=0; lane<count; lane++)
+        {
+            PBKDF2<HMAC<SHA256>,dkLen> final(passphrases[lane], passphrase_sizes[lane], &blocks[lane*mix_size], mix_size, 1);
+            memcpy( m_keys[lane], final.result(), dkLen );
+        }
+
+        memset( X, 0, sizeof(X) );
+        memset( T, 0, sizeof(T) );
+        memset( VJ, 0, sizeof(VJ) );
+        memset( m_spare, 0, sizeof(m_spare) );
+        if (progress)(progress)(100);
+    }
+
+    if ( blocks != 0 )
+    {
+        memset( blocks, 0, count * mix_size );
+        free( blocks );
+    }
+    for(uint8_t lane=0; lane<count; lane++)
+        if ( ( V[lane] != 0 ) && !scrypt_arena::give_back(V[lane]) )
+            scrypt_arena::unmap(V[lane], v_size);
+    return have_memory;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+template<uint32_t N, uint32_t r, uint32_t p, uint32_t dkLen>
+void scrypt_batch<N,r,p,dkLen>::Reset(void)
+{
+    memset( m_keys, 0, sizeof(m_keys) );
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+template<uint32_t N, uint32_t r, uint32_t p, uint32_t dkLen>
+void scrypt_batch<N,r,p,dkLen>::ROMix(uint8_t count, Salsa20Block ** V, progress_func progress)
+{
+    if (progress)(progress)(0);
+
+    // 2. Build V arrays, X and T taking turns as in scrypt_mixer::ROMix
+    for(uint32_t i=0; i < N; i += 2)
+    {
+        StoreV(count, V, i, X);
+        salsa20x8_block_mix(X, T, r);
+        StoreV(count, V, i+1, T);
+        salsa20x8_block_mix(T, X, r);
+    }
+
+    if (progress)(progress)(5);
+
+    // 3. Perform integerify mix loop
+    for(uint32_t i=0; i < N; i += 2)
+    {
+        IntegerifyStep(count, V, X, T);
+        IntegerifyStep(count, V, T, X);
+
+        if ( progress && ( ( i & ( SCRYPT_PROGRESS_STRIDE - 1 ) ) == 0 ) )(progress)( 5 + ( i * 95 / N ));
+    }
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+template<uint32_t N, uint32_t r, uint32_t p, uint32_t dkLen>
+inline void scrypt_batch<N,r,p,dkLen>::StoreV(uint8_t count, Salsa20Block ** V, uint32_t i, const Salsa20BlockX8 * x)
+{
+    // V[i] = X, each lane into its own V. Lanes that aren't in use go to the spare block
+    Salsa20Block * v[LANES];
+    for(uint8_t lane=0; lane<LANES; lane++)
+        v[lane] = ( lane < count ) ? &V[lane][i*r*2] : m_spare;
+    salsa20x8_get_lanes(x, v, r*2);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+template<uint32_t N, uint32_t r, uint32_t p, uint32_t dkLen>
+inline void scrypt_batch<N,r,p,dkLen>::IntegerifyStep(uint8_t count, Salsa20Block ** V, const Salsa20BlockX8 * in, Salsa20BlockX8 * out)
+{
+    // j = Integerify (X) mod N for each lane, gathering up the V[j]s
+    const Salsa20Block * v[LANES];
+    for(uint8_t lane=0; lane<LANES; lane++)
+        v[lane] = ( lane < count ) ? &V[lane][ ( in[(r*2)-1].word[0][lane] % N ) * r * 2 ] : m_spare;
+    salsa20x8_set_lanes(VJ, v, r*2);
+    // X = scryptBlockMix (X xor V[j])
+    salsa20x8_block_mix(in, out, r, VJ);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,81 @@
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  scrypt-batch.h - Header file for multi-buffer scrypt
+//
+//      Derives up to eight scrypt keys at once, one per lane of Salsa20x8, for when a host has
+//      a lot of master keys to work out one after another (warming up a service, say). Every
+//      calculation keeps its own fully populated V array and its own Integerify, only the
+//      BlockMix is shared, so the lanes are transposed into Salsa20BlockX8 for BlockMix and
+//      back out for V. The PBKDF2 either side of the mix is done one key at a time. Host only,
+//      a V array per lane is far more memory than an MCU has.
+//
+//  Copyright (C) 2020, Gazoodle (https://github.com/gazoodle)
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef _inc_scrypt_batch_h
+#define _inc_scrypt_batch_h
+
+#ifndef ARDUINO
+
+#include "scrypt.h"
+#include "salsa20x8.h"
+
+template<uint32_t N, uint32_t r, uint32_t p, uint32_t dkLen>
+class scrypt_batch
+{
+private:
+    scrypt_batch(const scrypt_batch& other) {}
+public:
+    scrypt_batch(void) { memset( m_keys, 0, sizeof(m_keys) ); }
+    ~scrypt_batch(void) { Reset(); }
+
+    static const uint8_t    LANES = SALSA20X8_LANES;
+
+    // Derive keys for `count` (up to LANES) passphrase and salt pairs, key n is at key(n)
+    // afterwards. Returns false, having done nothing, if there isn't the memory for a V array
+    // per key
+    bool hash(uint8_t count, const uint8_t * const * passphrases, const uint32_t * passphrase_sizes, const uint8_t * const * salts, const uint32_t * salt_sizes, progress_func progress);
+    const uint8_t * key(uint8_t lane) const { return m_keys[lane]; }
+
+    // Get V arrays for `count` lanes into the arena ahead of time. Faulting in a fresh V per
+    // lane otherwise costs about as much as the batch saves
+    static void prewarm(uint8_t count = LANES) { scrypt_arena::prewarm(N*r*2*sizeof(Salsa20Block), mix_min(count, SCRYPT_ARENA_MAX_CHUNKS)); }
+
+    void Reset(void);
+
+#ifndef TEST_SUITE
+private:
+#endif
+    // ROMix of one block from each of `count` calculations, already transposed into X
+    void ROMix(uint8_t count, Salsa20Block ** V, progress_func progress);
+    inline void StoreV(uint8_t count, Salsa20Block ** V, uint32_t i, const Salsa20BlockX8 * x);
+    inline void IntegerifyStep(uint8_t count, Salsa20Block ** V, const Salsa20BlockX8 * in, Salsa20BlockX8 * out);
+
+private:
+    Salsa20BlockX8  X[r*2];
+    Salsa20BlockX8  T[r*2];
+    Salsa20BlockX8  VJ[r*2];
+    // Where lanes without a calculation of their own store and find V
+    Salsa20Block    m_spare[r*2];
+    uint8_t         m_keys[LANES][dkLen];
+};
+
+#include "scrypt-batch-impl.h"
+
+#endif
+
+#endif
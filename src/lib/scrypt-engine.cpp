@@ -0,0 +1,259 @@
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  scrypt with runtime parameters
+//
+//  References
+//      https://tools.ietf.org/html/rfc7914
+//
+//  Copyright (C) 2020, Gazoodle (https://github.com/gazoodle)
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "scrypt-engine.h"
+#include "io.h"
+#include "pbkdf2.h"
+#include "scrypt-arena.h"
+#include "salsa20-unrolled.h"
+#include "salsa20-sse2.h"
+#include <stdlib.h>
+#include <string.h>
+#ifndef ARDUINO
+#include <chrono>
+#include <unistd.h>
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static uint32_t scrypt_engine_now_ms(void)
+{
+#ifdef ARDUINO
+    return millis();
+#else
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+scrypt_engine::scrypt_engine(uint32_t N, uint32_t r, uint32_t p, uint32_t dkLen)
+    : m_N(N), m_r(r), m_p(p), m_dkLen(dkLen), m_key(0)
+{
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool scrypt_engine::valid(uint32_t N, uint32_t r, uint32_t p, uint32_t dkLen)
+{
+    // N is a power of 2 greater than 1 and less than 2^(128 * r / 8)
+    if ( ( N < 2 ) || ( ( N & (N-1) ) != 0 ) )
+        return false;
+    if ( ( r == 0 ) || ( p == 0 ) || ( dkLen == 0 ) )
+        return false;
+    if ( ( r == 1 ) && ( N >= ( 1u << 16 ) ) )
+        return false;
+    // p * r < 2^30
+    if ( (uint64_t)p * r >= ( 1u << 30 ) )
+        return false;
+    return ( (uint64_t)p * r * 2 * sizeof(Salsa20Block) <= UINT32_MAX ) && ( memory(N, r) <= UINT32_MAX );
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+const uint8_t * scrypt_engine::hash( const char * passphrase, const char * salt, progress_func progress)
+{
+    return hash(reinterpret_cast<const uint8_t *>(passphrase), strlen(passphrase), reinterpret_cast<const uint8_t *>(salt), strlen(salt), progress);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+const uint8_t * scrypt_engine::hash( const uint8_t * passphrase, uint32_t passphrase_size, const uint8_t * salt, uint32_t salt_size, progress_func progress, const scrypt_cancel_token * cancel)
+{
+    Reset();
+    if ( !is_valid() )
+        return 0;
+
+    scrypt_callback_policy<> policy(progress, cancel);
+    policy.progress(0);
+
+    const uint32_t entry_size = m_r * 2 * sizeof(Salsa20Block);
+    const uint32_t v_size = get_memory();
+    uint8_t * B = (uint8_t *)malloc(m_p * entry_size);
+    Salsa20Block * XT = (Salsa20Block *)malloc(2 * entry_size);
+#ifndef ARDUINO
+    Salsa20Block * V = (Salsa20Block *)scrypt_arena::borrow(v_size);
+    if ( V == 0 )
+        V = (Salsa20Block *)scrypt_arena::map(v_size);
+#else
+    Salsa20Block * V = (Salsa20Block *)malloc(v_size);
+#endif
+    m_key = (uint8_t *)malloc(m_dkLen);
+
+    bool mixed = ( B != 0 ) && ( XT != 0 ) && ( V != 0 ) && ( m_key != 0 );
+    if ( mixed )
+    {
+        // 1. B = PBKDF2-HMAC-SHA256 (P, S, 1, p * 128 * r)
+        PBKDF2_derive< HMAC<SHA256> >::derive( passphrase, passphrase_size, salt, salt_size, 1, B, m_p * entry_size );
+
+        // 2. for i = 0 to p - 1 do B[i] = scryptROMix (r, B[i], N), one V for all of them
+        Salsa20Block * block = reinterpret_cast<Salsa20Block *>(B);
+        for(uint32_t i=0; mixed && ( i < m_p ); i++)
+        {
+            scrypt_share_policy< scrypt_callback_policy<> > lane(policy, i, 1, m_p);
+            mixed = ROMix(&block[i * m_r * 2], V, XT, &XT[m_r * 2], lane);
+        }
+
+        // 3. DK = PBKDF2-HMAC-SHA256 (P, B, 1, dkLen)
+        if ( mixed )
+            PBKDF2_derive< HMAC<SHA256> >::derive( passphrase, passphrase_size, B, m_p * entry_size, 1, m_key, m_dkLen );
+    }
+
+    if ( B != 0 )
+    {
+        memset( B, 0, m_p * entry_size );
+        free(B);
+    }
+    if ( XT != 0 )
+    {
+        memset( XT, 0, 2 * entry_size );
+        free(XT);
+    }
+    if ( V != 0 )
+    {
+#ifndef ARDUINO
+        if ( !scrypt_arena::give_back(V) )
+            scrypt_arena::unmap(V, v_size);
+#else
+        // Nothing else is going to clear it before the heap hands it out again
+        memset( V, 0, v_size );
+        free(V);
+#endif
+    }
+
+    if ( !mixed )
+    {
+        Reset();
+        return 0;
+    }
+    policy.progress(100);
+    return m_key;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void scrypt_engine::Reset(void)
+{
+    if ( m_key != 0 )
+    {
+        memset( m_key, 0, m_dkLen );
+        free(m_key);
+        m_key = 0;
+    }
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline void scrypt_engine::MixStep(const Salsa20Block * input, Salsa20Block * output, const Salsa20Block * other) const
+{
+#ifdef EMPW_X86
+    salsa20_sse2_block_mix(input, output, m_r, other);
+#else
+    salsa20_unrolled_block_mix(input, output, m_r, other);
+#endif
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+template<class Policy>
+bool scrypt_engine::ROMix(Salsa20Block * block, Salsa20Block * V, Salsa20Block * X, Salsa20Block * T, Policy& policy)
+{
+    const uint32_t blocks = m_r * 2;
+    const uint32_t due = Policy::stride - 1;
+    if ( Policy::has_progress ) policy.progress(0);
+
+    // 1. X = B, which is also V[0], in whatever layout MixStep wants
+#ifdef EMPW_X86
+    salsa20_sse2_shuffle(V, block, blocks);
+#else
+    memcpy( V, block, blocks * sizeof(Salsa20Block) );
+#endif
+
+    // 2. for i = 0 to N - 1 do V[i] = X, X = scryptBlockMix (X). Each BlockMix writes
+    //    straight into the next V entry, the last one into X
+    for(uint32_t i=0; i < m_N; i++)
+    {
+        if ( ( Policy::can_cancel ) && ( ( i & due ) == 0 ) && policy.cancelled() )
+        {
+            memset( V, 0, get_memory() );
+            return false;
+        }
+        MixStep( &V[i * blocks], ( i+1 < m_N ) ? &V[(i+1) * blocks] : X );
+    }
+
+    if ( Policy::has_progress ) policy.progress(5);
+
+    // 3. for i = 0 to N - 1 do j = Integerify (X) mod N, T = X xor V[j], X = scryptBlockMix (T)
+    //    with X and T taking turns, N being a power of 2 there's an even number of them
+    for(uint32_t i=0; i < m_N; i += 2)
+    {
+        if ( ( Policy::has_progress || Policy::can_cancel ) && ( ( i & due ) == 0 ) )
+        {
+            if ( policy.cancelled() )
+            {
+                memset( V, 0, get_memory() );
+                memset( X, 0, blocks * sizeof(Salsa20Block) );
+                memset( T, 0, blocks * sizeof(Salsa20Block) );
+                return false;
+            }
+            if ( Policy::has_progress ) policy.progress( 5 + ( (uint64_t)i * 95 / m_N ) );
+        }
+
+        // The first word of a block is in the same place in either layout
+        uint32_t j = X[blocks-1].entry[0].as_word32 & ( m_N - 1 );
+        MixStep( X, T, &V[j * blocks] );
+        j = T[blocks-1].entry[0].as_word32 & ( m_N - 1 );
+        MixStep( T, X, &V[j * blocks] );
+    }
+
+    // 4. B' = X
+#ifdef EMPW_X86
+    salsa20_sse2_unshuffle(block, X, blocks);
+#else
+    memcpy( block, X, blocks * sizeof(Salsa20Block) );
+#endif
+    return true;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+scrypt_calibration scrypt_engine::calibrate(uint32_t target_ms, uint64_t memory_budget, uint32_t r, uint32_t p)
+{
+#ifndef ARDUINO
+    if ( memory_budget == 0 )
+        memory_budget = (uint64_t)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGE_SIZE) / 2;
+#endif
+
+    scrypt_calibration found;
+    found.N = 0;
+    found.r = r;
+    found.p = p;
+    found.elapsed_ms = 0;
+    found.memory = 0;
+
+    // The time goes up with N, so the first one over the target is the end of it. Going
+    // past the top of 32 bits gives an N of 0, which isn't valid either
+    for(uint32_t N=SCRYPT_CALIBRATE_MIN_N; valid(N, r, p, SHA256::HASH_SIZE_BYTES); N *= 2)
+    {
+        if ( ( memory_budget > 0 ) && ( memory(N, r) > memory_budget ) )
+            break;
+
+        scrypt_engine engine(N, r, p, SHA256::HASH_SIZE_BYTES);
+        uint32_t start = scrypt_engine_now_ms();
+        if ( engine.hash("password", "NaCl") == 0 )
+            break;
+        uint32_t elapsed = scrypt_engine_now_ms() - start;
+        if ( elapsed > target_ms )
+            break;
+
+        found.N = N;
+        found.elapsed_ms = elapsed;
+        found.memory = memory(N, r);
+    }
+    return found;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,105 @@
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  scrypt-engine.h - Header file for scrypt with its parameters chosen at runtime
+//
+//      scrypt<N,r,p,dkLen> has its cost parameters as template arguments, which is what lets
+//      the mixer size its stack and sparse V at compile time, but it also means every cost
+//      setting is its own instantiation and trying a different one means a rebuild. The
+//      engine here takes N, r, p and dkLen when it's constructed and runs them all through
+//      the one compiled ROMix, with the same BlockMix kernels as the templates (SSE2 on x86,
+//      the unrolled scalar one elsewhere). It always has a fully populated V and runs the
+//      lanes one after the other, so it's for working out and using cost settings of our own
+//      rather than for squeezing MPW's into a microcontroller, that's still scrypt<>'s job.
+//
+//      calibrate() times hashes of doubling N on the machine it's running on and reports the
+//      largest one that keeps within a target time and memory budget.
+//
+//  Copyright (C) 2020, Gazoodle (https://github.com/gazoodle)
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef _inc_scrypt_engine_h
+#define _inc_scrypt_engine_h
+
+#include <stdint.h>
+#include "sha256.h"
+#include "salsa20.h"
+#include "scrypt-progress.h"
+
+// Smallest N calibrate tries
+#define SCRYPT_CALIBRATE_MIN_N      (16)
+
+// What calibrate found
+struct scrypt_calibration
+{
+    // Largest N within the target and budget, 0 if not even SCRYPT_CALIBRATE_MIN_N is
+    uint32_t    N;
+    uint32_t    r;
+    uint32_t    p;
+    // How long a hash with that N took
+    uint32_t    elapsed_ms;
+    // Bytes of V array it needs
+    uint64_t    memory;
+};
+
+class scrypt_engine
+{
+private:
+    scrypt_engine(const scrypt_engine& other) {}
+public:
+    scrypt_engine(uint32_t N, uint32_t r, uint32_t p, uint32_t dkLen);
+    ~scrypt_engine(void) { Reset(); }
+
+    // RFC 7914's limits on the parameters, plus the V array and B having to fit in 32 bits
+    static bool valid(uint32_t N, uint32_t r, uint32_t p, uint32_t dkLen);
+    bool is_valid(void) const { return valid(m_N, m_r, m_p, m_dkLen); }
+
+    // dkLen bytes of key, owned by the engine until the next hash or Reset. NULL if the
+    // parameters aren't valid, there isn't the memory for V or it was cancelled
+    const uint8_t * hash( const uint8_t * passphrase, uint32_t passphrase_size, const uint8_t * salt, uint32_t salt_size, progress_func progress = 0, const scrypt_cancel_token * cancel = 0);
+    // Convenience function
+    const uint8_t * hash( const char * passphrase, const char * salt, progress_func progress = 0);
+    const uint8_t * result(void) const { return m_key; }
+    // Wipe and forget the key
+    void Reset(void);
+
+    uint32_t get_N(void) const { return m_N; }
+    uint32_t get_r(void) const { return m_r; }
+    uint32_t get_p(void) const { return m_p; }
+    uint32_t get_dkLen(void) const { return m_dkLen; }
+    // Bytes of V array a hash needs
+    static uint64_t memory(uint32_t N, uint32_t r) { return (uint64_t)N * r * 2 * sizeof(Salsa20Block); }
+    uint64_t get_memory(void) const { return memory(m_N, m_r); }
+
+    // The largest N, doubling from SCRYPT_CALIBRATE_MIN_N, whose hash takes no more than
+    // `target_ms` here and whose V fits in `memory_budget` bytes (0 for half the physical
+    // memory on a host, whatever can be allocated on a microcontroller)
+    static scrypt_calibration calibrate(uint32_t target_ms, uint64_t memory_budget = 0, uint32_t r = 8, uint32_t p = 1);
+
+private:
+    template<class Policy>
+    bool ROMix(Salsa20Block * block, Salsa20Block * V, Salsa20Block * X, Salsa20Block * T, Policy& policy);
+    inline void MixStep(const Salsa20Block * input, Salsa20Block * output, const Salsa20Block * other = 0) const;
+
+private:
+    uint32_t    m_N;
+    uint32_t    m_r;
+    uint32_t    m_p;
+    uint32_t    m_dkLen;
+    uint8_t *   m_key;
+};
+
+#endif
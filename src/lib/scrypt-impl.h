@@ -22,10 +22,41 @@
 //  along with this program.  If not, see <https://www.gnu.org/licenses/>.
 //
 ///////////////////////////////////////////////////////////////////////////////////////////////////
+//  Emperical testing has shown these values work on Teensy 4.0 or 4.1 without external PSRAM.
+//  They're defined everywhere so the tests can check the Teensy layout on a host
+#define ROMIX_SPARSE_V_MALLOC_MAX   (493568)
+#define ROMIX_SPARSE_V_STACK_MAX    (419840-(60*1024))
+#if defined(ARDUINO_TEENSY40) || defined(ARDUINO_TEENSY41)
+//  The part of V that used to go on the stack. It's a static array now, still in DTCM, so a
+//  stepped scrypt, whose mixer lives from one step() to the next, gets it as well as a blocking
+//  one. Only one mixer can have it at a time, any other makes do with the heap
+class scrypt_local_tier
+{
+public:
+    static Salsa20Block* claim(void)
+    {
+        if ( in_use() )
+            return 0;
+        in_use() = true;
+        return buffer();
+    }
+    static void release(void)
+    {
+        // Unlike the stack, nothing else is going to write over it
+        memset( buffer(), 0, ROMIX_SPARSE_V_STACK_MAX );
+        in_use() = false;
+    }
+private:
+    static bool& in_use(void) { static bool claimed = false; return claimed; }
+    static Salsa20Block* buffer(void) { static Salsa20Block v[ROMIX_SPARSE_V_STACK_MAX / sizeof(Salsa20Block)]; return v; }
+};
+#endif
+///////////////////////////////////////////////////////////////////////////////////////////////////
 template<uint32_t N, uint32_t r, uint32_t p, uint32_t dkLen>
-const uint8_t * scrypt<N,r,p,dkLen>::hash( const uint8_t * passphrase, uint32_t passphrase_size, const uint8_t * salt, uint32_t salt_size, progress_func progress )
+template<class Policy>
+const uint8_t * scrypt<N,r,p,dkLen>::hash( const uint8_t * passphrase, uint32_t passphrase_size, const uint8_t * salt, uint32_t salt_size, Policy& policy )
 {
-    if (progress)(progress)(0);
+    if ( Policy::has_progress ) policy.progress(0);
 
     // Calculate some useful parameters to start with
     const uint32_t mix_size = p * 128 * r;
@@ -37,66 +68,340 @@ const uint8_t * scrypt<N,r,p,dkLen>::hash( const uint8_t * passphrase, uint32_t
     // Mix the seed using the ROMix Algorithm
     Salsa20Block* block = reinterpret_cast<Salsa20Block*>(second_salt);
 
+    bool mixed;
+    uint8_t warnings = 0;
     #if defined(ARDUINO_TEENSY40) || defined(ARDUINO_TEENSY41)
     uint32_t global_size = external_psram_size * 1024 * 1024;
     if ( global_size > 0 )
     {
-        GlobalMixer(block, progress, global_size);
+        mixed = GlobalMixer(block, policy, global_size);
     }
     else
     {
-        StackAndMallocMixer(block, progress);
+        mixed = StackAndMallocMixer(block, policy, warnings);
     }
     #elif defined(ARDUINO_FEATHER_ESP32)
-    scrypt_mixer<N,r,p,dkLen,0,131072> mixer;
-    mixer.Mix(block, progress);
+    typedef scrypt_mixer<N,r,p,dkLen,0,131072> esp32_mixer;
+    esp32_mixer mixer(0, 0, ( m_options.memory_budget > 0 ) ? esp32_mixer::heap_for_budget(m_options.memory_budget) : 131072);
+    warnings |= CheckHeap(mixer);
+    mixed = mixer.Mix(block, policy);
     #else
-    // Generic version uses fully populated V array
-    scrypt_mixer<N,r,p,dkLen,0,N*r*2*sizeof(Salsa20Block)> mixer;
-    mixer.Mix(block, progress);
+    // Generic version uses fully populated V array, unless it's been given a budget
+    typedef scrypt_mixer<N,r,p,dkLen,0,N*r*2*sizeof(Salsa20Block)> host_mixer;
+    const uint32_t full_size = N*r*2*sizeof(Salsa20Block);
+    const uint32_t lanes = concurrent_lanes();
+    uint32_t heap_size = full_size;
+    if ( m_options.memory_budget > 0 )
+        heap_size = host_mixer::heap_for_budget( m_options.memory_budget / lanes );
+
+    // or a file for the global tier, which takes whatever the budget doesn't cover
+    uint8_t* global_buffer = 0;
+    uint32_t global_size = 0;
+    if ( m_options.global_size > 0 )
+    {
+        uint32_t ram_size = ( m_options.memory_budget > 0 ) ? heap_size : 0;
+        global_size = mix_min( m_options.global_size / lanes, full_size - ram_size );
+        global_size -= global_size % ( r*2*sizeof(Salsa20Block) );
+        if ( global_size > 0 )
+            global_buffer = (uint8_t*)scrypt_arena::map_file( m_options.global_file, global_size * lanes );
+        if ( global_buffer != 0 )
+        {
+            heap_size = ram_size;
+        }
+        else
+        {
+            warnings |= SCRYPT_WARN_GLOBAL_MAP;
+            if ( !m_options.quiet )
+                IO << F("Failed to map scrypt global tier, using the heap") << endl;
+            global_size = 0;
+        }
+    }
+
+    if ( ( m_options.lane_mode == SCRYPT_LANES_THREADED ) && ( p > 1 ) )
+    {
+        bool heap_short = false;
+        mixed = host_mixer::MixThreaded(block, policy, heap_size, (Salsa20Block*)global_buffer, global_size, &heap_short, !m_options.quiet);
+        if ( heap_short )
+            warnings |= SCRYPT_WARN_HEAP_SHORT;
+    }
+    else if ( ( m_options.lane_mode == SCRYPT_LANES_INTERLEAVED ) && ( p > 1 ) )
+    {
+        host_mixer mixer_a((Salsa20Block*)global_buffer, global_size, heap_size);
+        host_mixer mixer_b((Salsa20Block*)(global_buffer + global_size), global_size, heap_size);
+        warnings |= CheckHeap(mixer_a) | CheckHeap(mixer_b);
+        mixed = host_mixer::MixInterleaved(mixer_a, mixer_b, block, policy);
+    }
+    else
+    {
+        host_mixer mixer((Salsa20Block*)global_buffer, global_size, heap_size);
+        warnings |= CheckHeap(mixer);
+        mixed = mixer.Mix(block, policy);
+    }
+
+    if ( global_buffer != 0 )
+        scrypt_arena::unmap_file(global_buffer, global_size * lanes);
     #endif
 
-    // Do final hash on the second salt
+    // Cancelled, the mixers have wiped V and the initial hash wipes B as it goes
     Reset();
-    m_final = new PBKDF2<HMAC<SHA256>,dkLen>(passphrase, passphrase_size, second_salt, mix_size, 1);
+    m_warnings = warnings;
+    if ( !mixed )
+        return 0;
+
+    // Do final hash on the second salt
+    FinalHash(passphrase, passphrase_size, second_salt);
+
+    if ( Policy::has_progress ) policy.progress(100);
+    return m_final->result();
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+template<uint32_t N, uint32_t r, uint32_t p, uint32_t dkLen>
+void scrypt<N,r,p,dkLen>::FinalHash(const uint8_t * passphrase, uint32_t passphrase_size, const uint8_t * second_salt)
+{
+    m_final = new PBKDF2<HMAC<SHA256>,dkLen>(passphrase, passphrase_size, second_salt, p * 128 * r, 1);
     if ( m_final == 0 )
     {
         IO << F("Failed to create PBKDF2 final hash") << endl;
         empw_exit(EXITCODE_NO_MEMORY);
     }
-
-    if (progress)(progress)(100);
-    return m_final->result();
 }
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 template<uint32_t N, uint32_t r, uint32_t p, uint32_t dkLen>
 void scrypt<N,r,p,dkLen>::Reset(void)
 {
+    ClearStep();
     if ( m_final != 0 )
     {
         delete m_final;
         m_final = 0;
     }
+    m_warnings = 0;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+template<uint32_t N, uint32_t r, uint32_t p, uint32_t dkLen>
+void scrypt<N,r,p,dkLen>::begin( const uint8_t * passphrase, uint32_t passphrase_size, const uint8_t * salt, uint32_t salt_size, progress_func progress )
+{
+    Reset();
+    m_step_progress = progress;
+    if (progress)(progress)(0);
+
+    // The passphrase is needed again for the final hash, well after the caller's moved on
+    m_step_passphrase = (uint8_t*)malloc( mix_max(passphrase_size, 1u) );
+    m_step_initial = new PBKDF2<HMAC<SHA256>,p*128*r>(passphrase, passphrase_size, salt, salt_size, 1);
+    if ( ( m_step_passphrase == 0 ) || ( m_step_initial == 0 ) )
+    {
+        IO << F("Failed to allocate stepped scrypt state") << endl;
+        empw_exit(EXITCODE_NO_MEMORY);
+    }
+    memcpy( m_step_passphrase, passphrase, passphrase_size );
+    m_step_passphrase_size = passphrase_size;
+
+    m_step_lane = 0;
+    m_step_mixer = NewStepMixer();
+    m_step_mixer->BeginROMix(reinterpret_cast<Salsa20Block*>(m_step_initial->result()));
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+template<uint32_t N, uint32_t r, uint32_t p, uint32_t dkLen>
+bool scrypt<N,r,p,dkLen>::step(uint32_t max_blockmix)
+{
+    if ( done() || ( m_step_mixer == 0 ) )
+        return done();
+
+    // Always get something done, even if asked for nothing
+    uint32_t budget = mix_max(max_blockmix, 1u);
+    Salsa20Block* block = reinterpret_cast<Salsa20Block*>(m_step_initial->result());
+    while ( true )
+    {
+        bool lane_done = m_step_mixer->StepROMix(budget);
+        if (m_step_progress)(m_step_progress)( ( m_step_lane * 100 / p ) + ( m_step_mixer->GetROMixProgress() / p ) );
+        if ( !lane_done )
+            return false;
+
+        m_step_mixer->EndROMix(block + m_step_lane*r*2);
+        if ( ++m_step_lane < p )
+        {
+            m_step_mixer->BeginROMix(block + m_step_lane*r*2);
+            if ( budget == 0 )
+                return false;
+            continue;
+        }
+
+        FinalHash(m_step_passphrase, m_step_passphrase_size, m_step_initial->result());
+        ClearStep();
+        if (m_step_progress)(m_step_progress)(100);
+        return true;
+    }
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+template<uint32_t N, uint32_t r, uint32_t p, uint32_t dkLen>
+void scrypt<N,r,p,dkLen>::ClearStep(void)
+{
+    if ( m_step_mixer != 0 )
+    {
+        // Given up on part way, so don't leave V lying about
+        if ( !done() )
+            m_step_mixer->Wipe();
+        delete m_step_mixer;
+        m_step_mixer = 0;
+    }
+    #if defined(ARDUINO_TEENSY40) || defined(ARDUINO_TEENSY41)
+    if ( m_step_local_tier )
+    {
+        scrypt_local_tier::release();
+        m_step_local_tier = false;
+    }
+    #endif
+    if ( m_step_initial != 0 )
+    {
+        delete m_step_initial;
+        m_step_initial = 0;
+    }
+    if ( m_step_passphrase != 0 )
+    {
+        memset( m_step_passphrase, 0, m_step_passphrase_size );
+        free(m_step_passphrase);
+        m_step_passphrase = 0;
+    }
+    m_step_passphrase_size = 0;
+    m_step_lane = 0;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+template<uint32_t N, uint32_t r, uint32_t p, uint32_t dkLen>
+typename scrypt<N,r,p,dkLen>::step_mixer* scrypt<N,r,p,dkLen>::NewStepMixer(void)
+{
+    // One lane at a time, so the V array gets the whole budget
+    Salsa20Block* global_buffer = 0;
+    uint32_t global_size = 0;
+    #if defined(ARDUINO_TEENSY40) || defined(ARDUINO_TEENSY41)
+    global_size = external_psram_size * 1024 * 1024;
+    if ( ( m_options.memory_budget > 0 ) && ( m_options.memory_budget < global_size ) )
+        global_size = m_options.memory_budget;
+    uint32_t heap_size = 0;
+    if ( global_size > 0 )
+    {
+        global_buffer = (Salsa20Block*)(0x70000000);
+    }
+    else
+    {
+        // Without PSRAM the local tier stands in for the global one, which gives the same
+        // tiers StackAndMallocMixer has
+        global_buffer = scrypt_local_tier::claim();
+        m_step_local_tier = ( global_buffer != 0 );
+        TeensyTiers(m_step_local_tier, global_size, heap_size);
+    }
+    #elif defined(ARDUINO_FEATHER_ESP32)
+    uint32_t heap_size = ( m_options.memory_budget > 0 ) ? step_mixer::heap_for_budget(m_options.memory_budget) : 131072;
+    #else
+    uint32_t heap_size = ( m_options.memory_budget > 0 ) ? step_mixer::heap_for_budget(m_options.memory_budget) : N*r*2*sizeof(Salsa20Block);
+    #endif
+
+    step_mixer* mixer = new step_mixer(global_buffer, global_size, heap_size);
+    if ( mixer == 0 )
+    {
+        IO << F("Failed to allocate stepped scrypt mixer") << endl;
+        empw_exit(EXITCODE_NO_MEMORY);
+    }
+    m_warnings |= CheckHeap(*mixer);
+    return mixer;
 }
 ///////////////////////////////////////////////////////////////////////////////////////////////////
+template<uint32_t N, uint32_t r, uint32_t p, uint32_t dkLen>
+template<class Mixer>
+uint8_t scrypt<N,r,p,dkLen>::CheckHeap(const Mixer& mixer) const
+{
+    if ( !mixer.heap_short() )
+        return 0;
+    if ( !m_options.quiet )
+        mixer.ReportHeapShort();
+    return SCRYPT_WARN_HEAP_SHORT;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+template<uint32_t N, uint32_t r, uint32_t p, uint32_t dkLen>
+uint32_t scrypt<N,r,p,dkLen>::concurrent_lanes(void) const
+{
+    if ( m_options.lane_mode == SCRYPT_LANES_INTERLEAVED )
+        return mix_min(p, 2);
+#ifndef ARDUINO
+    if ( m_options.lane_mode == SCRYPT_LANES_THREADED )
+        return p;
+#endif
+    return 1;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+#ifndef ARDUINO
+template<uint32_t N, uint32_t r, uint32_t p, uint32_t dkLen>
+void scrypt<N,r,p,dkLen>::prewarm(void)
+{
+    // All of V goes in the global tier's file unless there's a budget for the heap as well
+    if ( ( m_options.global_size > 0 ) && ( m_options.memory_budget == 0 ) )
+        return;
+    typedef scrypt_mixer<N,r,p,dkLen,0,N*r*2*sizeof(Salsa20Block)> host_mixer;
+    uint32_t heap_size = N*r*2*sizeof(Salsa20Block);
+    if ( m_options.memory_budget > 0 )
+        heap_size = host_mixer::heap_for_budget( m_options.memory_budget / concurrent_lanes() );
+    scrypt_arena::prewarm(heap_size, mix_min(concurrent_lanes(), SCRYPT_ARENA_MAX_CHUNKS));
+}
+#endif
+///////////////////////////////////////////////////////////////////////////////////////////////////
 #if defined(ARDUINO_TEENSY40) || defined(ARDUINO_TEENSY41)
 template<uint32_t N, uint32_t r, uint32_t p, uint32_t dkLen>
-void scrypt<N,r,p,dkLen>::GlobalMixer(Salsa20Block* block, progress_func progress, uint32_t global_size)
+template<class Policy>
+bool scrypt<N,r,p,dkLen>::GlobalMixer(Salsa20Block* block, Policy& policy, uint32_t global_size)
 {
     // If someone has been kind enough to solder a PSRAM chip or two on the board
     // we can use that to great effect
-    scrypt_mixer<N,r,p,dkLen,0, 0> mixer((Salsa20Block*)(0x70000000), global_size);
-    mixer.Mix(block, progress);
+    if ( ( m_options.memory_budget > 0 ) && ( m_options.memory_budget < global_size ) )
+        global_size = m_options.memory_budget;
+
+    if ( ( m_options.lane_mode == SCRYPT_LANES_INTERLEAVED ) && ( p > 1 ) )
+    {
+        // Each lane gets half of the PSRAM for its V array
+        uint32_t half_size = global_size / 2;
+        scrypt_mixer<N,r,p,dkLen,0, 0> mixer_a((Salsa20Block*)(0x70000000), half_size);
+        scrypt_mixer<N,r,p,dkLen,0, 0> mixer_b((Salsa20Block*)(0x70000000 + half_size), half_size);
+        return scrypt_mixer<N,r,p,dkLen,0, 0>::MixInterleaved(mixer_a, mixer_b, block, policy);
+    }
+    else
+    {
+        scrypt_mixer<N,r,p,dkLen,0, 0> mixer((Salsa20Block*)(0x70000000), global_size);
+        return mixer.Mix(block, policy);
+    }
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+template<uint32_t N, uint32_t r, uint32_t p, uint32_t dkLen>
+template<class Policy>
+bool scrypt<N,r,p,dkLen>::StackAndMallocMixer(Salsa20Block* block, Policy& policy, uint8_t& warnings)
+{
+    // The local tier goes in as the global one, it's the same DTCM the stack tier had
+    Salsa20Block* local_tier = scrypt_local_tier::claim();
+    uint32_t local_size, heap_size;
+    TeensyTiers(local_tier != 0, local_size, heap_size);
+    bool mixed;
+    {
+        scrypt_mixer<N,r,p,dkLen,0,ROMIX_SPARSE_V_MALLOC_MAX> mixer(local_tier, local_size, heap_size);
+        warnings |= CheckHeap(mixer);
+        mixed = mixer.Mix(block, policy);
+    }
+    if ( local_tier != 0 )
+        scrypt_local_tier::release();
+    return mixed;
 }
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 template<uint32_t N, uint32_t r, uint32_t p, uint32_t dkLen>
-void scrypt<N,r,p,dkLen>::StackAndMallocMixer(Salsa20Block* block, progress_func progress)
+void scrypt<N,r,p,dkLen>::TeensyTiers(bool have_local, uint32_t& local_size, uint32_t& heap_size) const
 {
-    //  Emperical testing has shown these values work on Teensy 4.0 or 4.1 without external PSRAM
-    #define ROMIX_SPARSE_V_MALLOC_MAX   (493568)
-    #define ROMIX_SPARSE_V_STACK_MAX    (419840-(60*1024))
-    scrypt_mixer<N,r,p,dkLen,ROMIX_SPARSE_V_STACK_MAX, ROMIX_SPARSE_V_MALLOC_MAX> mixer;
-    mixer.Mix(block, progress);
+    local_size = have_local ? ROMIX_SPARSE_V_STACK_MAX : 0;
+    heap_size = ROMIX_SPARSE_V_MALLOC_MAX;
+    if ( m_options.memory_budget == 0 )
+        return;
+
+    // The budget covers both, the local tier first as it's the faster memory
+    const uint32_t entry_size = r * 2 * sizeof(Salsa20Block);
+    local_size = mix_min( local_size, m_options.memory_budget - ( m_options.memory_budget % entry_size ) );
+    if ( m_options.memory_budget > local_size )
+        heap_size = mix_min( heap_size, step_mixer::heap_for_budget(m_options.memory_budget - local_size) );
+    else
+        heap_size = 0;
 }
 #endif
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -24,7 +24,19 @@
 
 #include <stdint.h>
 #include <functional>
+#ifndef ARDUINO
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#endif
 #include "salsa20.h"
+#include "scrypt-arena.h"
+#include "scrypt-progress.h"
+#include "salsa20-unrolled.h"
+#include "salsa20-sse2.h"
+#include "salsa20-avx2.h"
 
 /*
     Algorithm scryptROMix https://tools.ietf.org/html/rfc7914#page-6
@@ -94,45 +106,150 @@
 //
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
-typedef std::function<void (uint8_t percent)> progress_func;
+// How the p lanes of the mix get run. Sequential does one ROMix after another, interleaved
+// runs lanes in pairs, alternating BlockMix steps between the two, each lane with its own V
+// array. That gives the CPU two independent Salsa20 chains to work on and lets one lane's
+// V[j] fetch overlap the other lane's compute, at the cost of twice the V memory
+enum scrypt_lane_mode
+{
+    SCRYPT_LANES_SEQUENTIAL,
+    SCRYPT_LANES_INTERLEAVED,
+#ifndef ARDUINO
+    // Every lane on its own thread with its own V array (hosts only)
+    SCRYPT_LANES_THREADED,
+#endif
+};
+
+// How often the calling thread gathers up the lane progress while the threads run
+#define SCRYPT_THREAD_PROGRESS_MS   (20)
 #define mix_min(a,b)        ((a)<(b)?(a):(b))
 #define mix_max(a,b)        ((a)>(b)?(a):(b))
 
+// What the sparse V recompute cache got up to, counted across every ROMix the mixer has run
+struct scrypt_mixer_stats
+{
+    uint32_t    cache_slots;        // Leftover V entries in use as the cache
+    uint32_t    lookups;            // Phase 2 V[j] fetches that weren't a stored entry
+    uint32_t    hits;               // ... and of those, how many resumed from the cache
+    uint32_t    replayed;           // BlockMix steps spent rebuilding V[j]
+};
+
 template<uint32_t N, uint32_t r, uint32_t p, uint32_t dkLen, uint32_t stack_allocation, uint32_t heap_allocation>
 class scrypt_mixer
 {
 public:
     scrypt_mixer(void) : scrypt_mixer(0,0) {}
-    scrypt_mixer(Salsa20Block* global_buffer, uint32_t global_size) : m_heap_buffer(0), m_global_buffer(global_buffer), sparse_factor(1)
+    scrypt_mixer(Salsa20Block* global_buffer, uint32_t global_size) : scrypt_mixer(global_buffer, global_size, heap_allocation) {}
+    // As above, but with the heap part of V sized at runtime rather than by heap_allocation
+    scrypt_mixer(Salsa20Block* global_buffer, uint32_t global_size, uint32_t heap_size) : m_heap_buffer(0), m_global_buffer(global_buffer), sparse_factor(1), sparse_shift(0), sparse_mask(0), sparse_pow2(true), m_v_base(0), m_v_table(0), m_cache_tags(0), m_cache_enabled(true), m_romix_step(0)
     {
-        sparse_v_malloc_blocks = heap_allocation / ( r * 2 * sizeof(Salsa20Block) );
+        static_assert( ( N > 1 ) && ( ( N & (N-1) ) == 0 ), "scrypt N must be a power of 2 greater than 1" );
+        memset(&m_stats, 0, sizeof(m_stats));
+        sparse_v_malloc_blocks = heap_size / ( r * 2 * sizeof(Salsa20Block) );
         sparse_v_stack_blocks = countof(m_stack_buffer)/(r*2);
         sparse_v_global_blocks = global_size / ( r * 2 * sizeof(Salsa20Block) );
-        if ( sparse_v_malloc_blocks + sparse_v_stack_blocks + sparse_v_global_blocks > 0 )
-            sparse_factor = mix_min( N, mix_max(1, ( N / (sparse_v_malloc_blocks + sparse_v_stack_blocks + sparse_v_global_blocks ))));
-        if ( N % (sparse_v_malloc_blocks + sparse_v_stack_blocks + sparse_v_global_blocks ) != 0 )
-            sparse_factor++;
+        m_wanted_malloc_blocks = sparse_v_malloc_blocks;
+        AllocateHeap();
+        uint32_t total_entries = sparse_v_malloc_blocks + sparse_v_stack_blocks + sparse_v_global_blocks;
+        if ( total_entries > 0 )
+        {
+            // Smallest factor that fits the stored entries into what there is
+            sparse_factor = mix_min( N, mix_max(1, ( N / total_entries )));
+            if ( N % total_entries != 0 )
+                sparse_factor++;
+
+            // and the smallest power of two that does. The power of two lets phase 2 find V[j]
+            // with a shift and a mask, and leaves more entries over for the recompute cache, but
+            // may mean longer replays. Take it unless it works out more expensive
+            while ( ( 1u << sparse_shift ) < sparse_factor )
+                sparse_shift++;
+            if ( ExpectedReplays( 1 << sparse_shift, total_entries ) <= ExpectedReplays( sparse_factor, total_entries ) )
+                sparse_factor = 1 << sparse_shift;
+            sparse_pow2 = ( sparse_factor == ( 1u << sparse_shift ) );
+            sparse_mask = sparse_factor - 1;
+        }
         //IO << "N=" << N << " malloc_blocks=" << sparse_v_malloc_blocks << " stack_blocks=" << sparse_v_stack_blocks << " global_blocks=" << sparse_v_global_blocks << " sparse_factor=" << sparse_factor << endl;
-        if ( sparse_v_malloc_blocks > 0 )
+        // sparse_factor gets rounded up, so there are often a few entries more than the stored
+        // V entries need. Those become the recompute cache
+        uint32_t stored_entries = StoredEntries(sparse_factor);
+        if ( ( sparse_factor > 1 ) && ( total_entries > stored_entries ) )
         {
-            m_heap_buffer = (Salsa20Block*)malloc(r*2*sparse_v_malloc_blocks*sizeof(Salsa20Block));
-            if ( m_heap_buffer == 0 )
-            {
-                IO << F("Failed to allocate ROMix heap buffer of ") << r*2*sparse_v_malloc_blocks*sizeof(Salsa20Block) << endl;
-                empw_exit(EXITCODE_NO_MEMORY);
-            }
+            m_cache_tags = (uint32_t*)malloc( ( total_entries - stored_entries ) * sizeof(uint32_t) );
+            if ( m_cache_tags != 0 )
+                m_stats.cache_slots = total_entries - stored_entries;
         }
+
+        BuildAddressMap();
     }
     ~scrypt_mixer(void)
     {
         if ( m_heap_buffer != 0 )
         {
+#ifndef ARDUINO
+            if ( !scrypt_arena::give_back(m_heap_buffer) )
+                scrypt_arena::unmap(m_heap_buffer, r*2*sparse_v_malloc_blocks*sizeof(Salsa20Block));
+#else
             free(m_heap_buffer);
+#endif
             m_heap_buffer = 0;
         }
+        if ( m_cache_tags != 0 )
+        {
+            free(m_cache_tags);
+            m_cache_tags = 0;
+        }
+        if ( m_v_table != 0 )
+        {
+            free(m_v_table);
+            m_v_table = 0;
+        }
+    }
+
+    // How much heap to ask for so the whole V array, stack part included, fits in `budget`
+    // bytes. Never more than a fully populated V needs, and never less than one entry
+    static uint32_t heap_for_budget(uint32_t budget)
+    {
+        const uint32_t entry_size = r * 2 * sizeof(Salsa20Block);
+        const uint32_t stack_size = sizeof(m_stack_buffer);
+        const uint32_t stack_entries = stack_size / entry_size;
+        uint32_t entries = ( budget > stack_size ) ? ( budget - stack_size ) / entry_size : 0;
+        if ( entries + stack_entries > N )
+            entries = ( stack_entries < N ) ? N - stack_entries : 0;
+        if ( entries + stack_entries == 0 )
+            entries = 1;
+        return entries * entry_size;
+    }
+
+    uint32_t get_sparse_factor(void) const { return sparse_factor; }
+    // How many bytes of heap V actually got, which can be less than asked for
+    uint32_t get_heap_size(void) const { return sparse_v_malloc_blocks * r * 2 * sizeof(Salsa20Block); }
+    // Whether it got less. The mixer doesn't say so itself as it may be on a thread that
+    // shouldn't be writing to IO, ReportHeapShort() says so for whoever can
+    bool heap_short(void) const { return sparse_v_malloc_blocks != m_wanted_malloc_blocks; }
+    void ReportHeapShort(void) const
+    {
+        if ( heap_short() )
+            IO << F("ROMix heap buffer of ") << m_wanted_malloc_blocks*r*2*sizeof(Salsa20Block) << F(" unavailable, using ")
+               << get_heap_size() << F(" with sparse factor ") << sparse_factor << endl;
+    }
+
+    // Number of V entries stored with a given sparse factor
+    static inline uint32_t StoredEntries(uint32_t factor) { return ( N + factor - 1 ) / factor; }
+
+    // Rough average of the BlockMix replays a phase 2 lookup needs with a sparse factor of
+    // `factor`, allowing for the part of the segments the leftover entries can cache
+    static double ExpectedReplays(uint32_t factor, uint32_t total_entries)
+    {
+        uint32_t stored = StoredEntries(factor);
+        double coverage = ( total_entries > stored ) ? mix_min( 1.0, (double)( total_entries - stored ) / stored ) : 0.0;
+        uint32_t half = factor / 2;
+        return ( factor - 1 ) / 2.0 - coverage * half * ( factor - half ) / factor;
     }
+    const scrypt_mixer_stats& get_stats(void) const { return m_stats; }
+    // The recompute cache is on by default whenever there's leftover memory for it
+    void set_recompute_cache(bool enable) { m_cache_enabled = enable; }
 
-    inline void Salsa20(Salsa20Block& block, uint8_t rounds) const
+    static inline void Salsa20(Salsa20Block& block, uint8_t rounds)
     {
         /*
             Implement algorithm from https://tools.ietf.org/html/rfc7914#page-4
@@ -143,7 +260,7 @@ public:
         block.Add(X);
     }
 
-    inline void BlockMix(const Salsa20Block *input, Salsa20Block *output) const
+    static inline void BlockMix(const Salsa20Block *input, Salsa20Block *output)
     {
         /*
             Implement algorithmn from https://tools.ietf.org/html/rfc7914#page-5
@@ -192,10 +309,149 @@ public:
         }
     }
 
+    // ROMix works on its blocks in whatever layout the fastest BlockMix wants, converting
+    // on the way in and out. On x86 that's the SSE2 diagonal layout, elsewhere they're
+    // left as they are
+    inline void LoadX(const Salsa20Block* block)
+    {
+#ifdef EMPW_X86
+        salsa20_sse2_shuffle(X, block, r*2);
+#else
+        memcpy( X, block, sizeof(X));
+#endif
+    }
+
+    inline void StoreX(Salsa20Block* block) const
+    {
+#ifdef EMPW_X86
+        salsa20_sse2_unshuffle(block, X, r*2);
+#else
+        memcpy( block, X, sizeof(X));
+#endif
+    }
+
+    // X = BlockMix (input), or with `other` given, X = BlockMix (input xor other) without
+    // ever storing the xor
+    static inline void MixStep(const Salsa20Block *input, Salsa20Block *output, const Salsa20Block *other = NULL)
+    {
+#ifdef EMPW_X86
+        salsa20_sse2_block_mix(input, output, r, other);
+#else
+        salsa20_unrolled_block_mix<r>(input, output, other);
+#endif
+    }
+
+    // One BlockMix step for each of two lanes
+    static inline void MixStep2(const Salsa20Block *input_a, Salsa20Block *output_a, const Salsa20Block *input_b, Salsa20Block *output_b,
+                                const Salsa20Block *other_a = NULL, const Salsa20Block *other_b = NULL)
+    {
+#ifdef EMPW_X86
+        if ( cpu_has_avx2() )
+        {
+            salsa20_avx2_block_mix_x2(input_a, output_a, input_b, output_b, r, other_a, other_b);
+            return;
+        }
+#endif
+        scrypt_mixer::MixStep(input_a, output_a, other_a);
+        scrypt_mixer::MixStep(input_b, output_b, other_b);
+    }
+
+    // V[i] = X in phase 1. Nothing reads V[i] again until phase 2, by which time it would
+    // long since have been evicted, so on x86 the stores go around the cache rather than
+    // pushing out the lines we do want
+    static inline void StoreV(Salsa20Block* v, const Salsa20Block* x)
+    {
+#ifdef EMPW_X86
+        if ( ( (uintptr_t)v & 15 ) == 0 )
+        {
+            const __m128i * from = reinterpret_cast<const __m128i *>(x);
+            __m128i * to = reinterpret_cast<__m128i *>(v);
+            for(uint32_t i=0; i < r*2*sizeof(Salsa20Block)/sizeof(__m128i); i++)
+                _mm_stream_si128(&to[i], _mm_loadu_si128(&from[i]));
+            return;
+        }
+#endif
+        memcpy(v, x, r*2*sizeof(Salsa20Block));
+    }
+
+    // Make the streamed phase 1 stores visible before phase 2 starts reading them
+    static inline void StoreVDone(void)
+    {
+#ifdef EMPW_X86
+        _mm_sfence();
+#endif
+    }
+
+    // Which sparse segment V[k] is in and how far into it
+    inline uint32_t SegmentOf(uint32_t k) const { return sparse_pow2 ? ( k >> sparse_shift ) : ( k / sparse_factor ); }
+    inline uint32_t OffsetOf(uint32_t k) const { return sparse_pow2 ? ( k & sparse_mask ) : ( k % sparse_factor ); }
+
     inline Salsa20Block* get_v_ptr(uint32_t index)
     {
         // Convert to sparse index
-        index = index/sparse_factor;
+        return get_entry_ptr(SegmentOf(index));
+    }
+
+    inline Salsa20Block* get_entry_ptr(uint32_t index)
+    {
+        if ( m_v_base != 0 )
+            return &m_v_base[r*2*index];
+        if ( m_v_table != 0 )
+            return m_v_table[index];
+        return find_entry_ptr(index);
+    }
+
+    // Get the heap part of V. If there isn't that much memory to be had, keep halving the
+    // request until it fits; V just gets sparser and ROMix slower. Only when there's no room
+    // for even the smallest V that would work do we give up
+    void AllocateHeap(void)
+    {
+        const uint32_t entry_size = r * 2 * sizeof(Salsa20Block);
+        const uint32_t floor = ( sparse_v_stack_blocks + sparse_v_global_blocks > 0 ) ? 0 : 1;
+        while ( sparse_v_malloc_blocks > 0 )
+        {
+#ifndef ARDUINO
+            m_heap_buffer = (Salsa20Block*)scrypt_arena::borrow(sparse_v_malloc_blocks*entry_size);
+            if ( m_heap_buffer == 0 )
+                m_heap_buffer = (Salsa20Block*)scrypt_arena::map(sparse_v_malloc_blocks*entry_size);
+#else
+            m_heap_buffer = (Salsa20Block*)malloc(sparse_v_malloc_blocks*entry_size);
+#endif
+            if ( ( m_heap_buffer != 0 ) || ( sparse_v_malloc_blocks <= floor ) )
+                break;
+            sparse_v_malloc_blocks = mix_max( floor, sparse_v_malloc_blocks / 2 );
+        }
+        if ( ( m_heap_buffer == 0 ) && ( sparse_v_malloc_blocks > 0 ) )
+        {
+            IO << F("Failed to allocate ROMix heap buffer of ") << sparse_v_malloc_blocks*entry_size << endl;
+            empw_exit(EXITCODE_NO_MEMORY);
+        }
+    }
+
+    // V entries can be spread over the stack, heap and global tiers. When they're all in one
+    // tier an entry is just an offset from its start, otherwise a table with the address of
+    // each entry saves working out which tier it's in on every access. If there isn't the
+    // memory for the table the tiers get walked every time
+    void BuildAddressMap(void)
+    {
+        uint32_t total_entries = sparse_v_malloc_blocks + sparse_v_stack_blocks + sparse_v_global_blocks;
+        if ( total_entries == sparse_v_stack_blocks )
+            m_v_base = m_stack_buffer;
+        else if ( total_entries == sparse_v_malloc_blocks )
+            m_v_base = m_heap_buffer;
+        else if ( total_entries == sparse_v_global_blocks )
+            m_v_base = m_global_buffer;
+        else
+        {
+            m_v_table = (Salsa20Block**)malloc( total_entries * sizeof(Salsa20Block*) );
+            if ( m_v_table != 0 )
+                for(uint32_t i=0; i < total_entries; i++)
+                    m_v_table[i] = find_entry_ptr(i);
+        }
+    }
+
+    inline Salsa20Block* find_entry_ptr(uint32_t index)
+    {
         if ( sizeof(m_stack_buffer) > 0 )
         {
             if ( index < sparse_v_stack_blocks )
@@ -208,61 +464,436 @@ public:
         return &m_global_buffer[r*2*index];
     }
 
-    void ROMix(Salsa20Block* block, progress_func progress)
+    // The recompute cache keeps V[k] for k half way through a sparse segment, one slot per
+    // segment, the segment picking its slot with a simple modulo. Phase 1 fills it as it
+    // goes past, and phase 2 replaces entries with whatever it has most recently rebuilt
+    inline uint32_t CacheOffset(void) const { return sparse_factor >> 1; }
+    inline bool CacheActive(void) const { return m_cache_enabled && ( m_stats.cache_slots > 0 ); }
+    inline Salsa20Block* get_cache_ptr(uint32_t slot) { return get_entry_ptr( StoredEntries(sparse_factor) + slot ); }
+
+    inline void ResetCache(void)
     {
-        if (progress)(progress)(0);
+        if ( m_cache_tags != 0 )
+            memset( m_cache_tags, 0xff, m_stats.cache_slots * sizeof(uint32_t) );
+    }
 
-        // 1. X = B
-        memcpy( X, block, sizeof(X));
+    // Hang on to V[k] if it's one the cache wants
+    inline void CacheV(uint32_t k, const Salsa20Block* v)
+    {
+        if ( !CacheActive() || ( OffsetOf(k) != CacheOffset() ) )
+            return;
+        uint32_t segment = SegmentOf(k);
+        uint32_t slot = segment % m_stats.cache_slots;
+        memcpy( get_cache_ptr(slot), v, sizeof(LocalV) );
+        m_cache_tags[slot] = segment;
+    }
+
+    // Finds the nearest known state at or before V[j], which is either the stored entry at
+    // the start of its segment or the cached one part way through, and points `v` at it.
+    // Returns how many BlockMix steps short of V[j] that is
+    inline uint32_t NearestV(uint32_t j, const Salsa20Block*& v)
+    {
+        uint32_t steps = OffsetOf(j);
+        v = get_v_ptr(j);
+        if ( steps == 0 )
+            return 0;
 
-        // 2. Build V array
-        for(uint32_t i=0; i < N; i++)
+        m_stats.lookups++;
+        if ( CacheActive() && ( steps >= CacheOffset() ) )
         {
-            // V[i] = X
-            if (i%sparse_factor==0)
-                memcpy(get_v_ptr(i), X, sizeof(X));
-            // X = scryptBlockMix (X)
-            BlockMix(X, T);
-            memcpy(X, T, sizeof(X));
+            uint32_t segment = SegmentOf(j);
+            uint32_t slot = segment % m_stats.cache_slots;
+            if ( m_cache_tags[slot] == segment )
+            {
+                m_stats.hits++;
+                steps -= CacheOffset();
+                v = get_cache_ptr(slot);
+            }
         }
 
-        if (progress)(progress)(5);
+        m_stats.replayed += steps;
+        return steps;
+    }
 
-        // 3. Perform integerify mix loop
-        for (uint32_t i = 0; i < N; i++)
+    // Rebuilt V entries ping-pong between LocalV and Spare, this is whichever `v` isn't
+    inline Salsa20Block* NextLocalV(const Salsa20Block* v) { return ( v == LocalV ) ? Spare : LocalV; }
+
+    // V[j], wherever it is or has to be rebuilt to
+    inline const Salsa20Block* GetV(uint32_t j)
+    {
+        const Salsa20Block* v;
+        for (uint32_t k = NearestV(j, v); k > 0; k--)
         {
-            // j = Integerify (X) mod N
-            //          where Integerify (B[0] ... B[2 * r - 1]) is defined
-            //          as the result of interpreting B[2 * r - 1] as a
-            //          little-endian integer.
-            uint32_t j = X[(r*2)-1].entry[0].as_word32 % N;
-            // T = X xor V[j]
-            memcpy( LocalV, get_v_ptr(j), sizeof(LocalV) );
-            for (uint32_t k = (j/sparse_factor)*sparse_factor; k < j; k++)
+            Salsa20Block* next = NextLocalV(v);
+            MixStep(v, next);
+            CacheV(j - k + 1, next);
+            v = next;
+        }
+        return v;
+    }
+
+    // V[i] = X in phase 1, or into the recompute cache if V[i] isn't one that gets stored
+    inline void KeepV(uint32_t i, const Salsa20Block* x)
+    {
+        if (OffsetOf(i)==0)
+            StoreV(get_v_ptr(i), x);
+        else
+            CacheV(i, x);
+    }
+
+    // One pass of the phase 2 loop, from `in` to `out`
+    inline void IntegerifyStep(const Salsa20Block* in, Salsa20Block* out)
+    {
+        // j = Integerify (X) mod N
+        //          where Integerify (B[0] ... B[2 * r - 1]) is defined
+        //          as the result of interpreting B[2 * r - 1] as a
+        //          little-endian integer.
+        uint32_t j = in[(r*2)-1].entry[0].as_word32 % N;
+        // T = X xor V[j], X = scryptBlockMix (T)
+        MixStep(in, out, GetV(j));
+    }
+
+    // Whether it's time to look at the policy, on the i'th iteration of either loop
+    template<class Policy>
+    static inline bool PolicyDue(uint32_t i)
+    {
+        static_assert( ( Policy::stride >= 2 ) && ( ( Policy::stride & (Policy::stride-1) ) == 0 ), "scrypt progress stride must be a power of 2" );
+        return ( Policy::has_progress || Policy::can_cancel ) && ( ( i & ( Policy::stride - 1 ) ) == 0 );
+    }
+
+    // Clear out everything the mix has been through, for when it stops part way
+    void Wipe(void)
+    {
+        const uint32_t entry_size = r * 2 * sizeof(Salsa20Block);
+        if ( sparse_v_stack_blocks > 0 )
+            memset( m_stack_buffer, 0, sparse_v_stack_blocks * entry_size );
+        if ( m_heap_buffer != 0 )
+            memset( m_heap_buffer, 0, sparse_v_malloc_blocks * entry_size );
+        if ( m_global_buffer != 0 )
+            memset( m_global_buffer, 0, sparse_v_global_blocks * entry_size );
+        memset( X, 0, sizeof(X) );
+        memset( T, 0, sizeof(T) );
+        memset( LocalV, 0, sizeof(LocalV) );
+        memset( Spare, 0, sizeof(Spare) );
+    }
+
+    // Returns false, with the mixer wiped, if the policy cancels part way
+    template<class Policy>
+    bool ROMix(Salsa20Block* block, Policy& policy)
+    {
+        if ( Policy::has_progress ) policy.progress(0);
+
+        // 1. X = B
+        LoadX(block);
+        ResetCache();
+
+        // 2. Build V array. X and T take turns being the input and output of BlockMix, so
+        //    there's nothing to copy back (N is a power of 2, so there are an even number)
+        for(uint32_t i=0; i < N; i += 2)
+        {
+            if ( PolicyDue<Policy>(i) && policy.cancelled() )
             {
-                BlockMix(LocalV, T);
-                memcpy(LocalV, T, sizeof(LocalV));
+                Wipe();
+                return false;
             }
 
-            for (uint32_t k = 0; k < r*2 ; k++ )
-                T[k].Xor(X[k], LocalV[k]);
-            // X = scryptBlockMix (T)
-            BlockMix(T, X);
+            // V[i] = X, X = scryptBlockMix (X)
+            KeepV(i, X);
+            MixStep(X, T);
+            KeepV(i+1, T);
+            MixStep(T, X);
+        }
+
+        StoreVDone();
+        if ( Policy::has_progress ) policy.progress(5);
 
-            if (progress)(progress)( 5 + ( i * 95 / N ));
+        // 3. Perform integerify mix loop, again with X and T taking turns
+        for (uint32_t i = 0; i < N; i += 2)
+        {
+            if ( PolicyDue<Policy>(i) )
+            {
+                if ( policy.cancelled() )
+                {
+                    Wipe();
+                    return false;
+                }
+                if ( Policy::has_progress ) policy.progress( 5 + ( i * 95 / N ));
+            }
+
+            IntegerifyStep(X, T);
+            IntegerifyStep(T, X);
         }
 
         // 4. X = B'
-        memcpy( block, X, sizeof(X));
+        StoreX(block);
+        return true;
     }
 
-    void Mix(Salsa20Block* block, progress_func progress)
+    bool ROMix(Salsa20Block* block, progress_func progress)
+    {
+        scrypt_callback_policy<> policy(progress);
+        return ROMix(block, policy);
+    }
+
+    // ROMix a slice at a time, for callers that can't block for the whole thing: BeginROMix,
+    // StepROMix until it says it's finished, then EndROMix. Each pass of either loop costs
+    // two BlockMix steps plus any it took to rebuild a sparse V[j], which is taken from
+    // `budget`. A pass is never split, so the budget can run a little over. Same result as ROMix
+    void BeginROMix(const Salsa20Block* block)
+    {
+        LoadX(block);
+        ResetCache();
+        m_romix_step = 0;
+    }
+
+    bool StepROMix(uint32_t& budget)
+    {
+        while ( ( budget > 0 ) && ( m_romix_step < 2*N ) )
+        {
+            uint32_t replayed = m_stats.replayed;
+            uint32_t i = m_romix_step;
+            if ( i < N )
+            {
+                KeepV(i, X);
+                MixStep(X, T);
+                KeepV(i+1, T);
+                MixStep(T, X);
+                if ( i+2 == N )
+                    StoreVDone();
+            }
+            else
+            {
+                IntegerifyStep(X, T);
+                IntegerifyStep(T, X);
+            }
+            m_romix_step += 2;
+            uint32_t cost = 2 + m_stats.replayed - replayed;
+            budget -= mix_min(budget, cost);
+        }
+        return m_romix_step == 2*N;
+    }
+
+    // Same scale as ROMix's progress
+    uint8_t GetROMixProgress(void) const
+    {
+        return ( m_romix_step < N ) ? ( m_romix_step * 5 / N ) : ( 5 + ( ( m_romix_step - N ) * 95 / N ) );
+    }
+
+    void EndROMix(Salsa20Block* block) const { StoreX(block); }
+
+    template<class Policy>
+    bool Mix(Salsa20Block* block, Policy& policy)
     {
         for(uint32_t i=0; i<p; i++, block += r*2)
-            ROMix(block, [&] ( uint8_t percent ) {
-                if (progress)(progress)( ( i * 100 / p ) + ( percent / p ) );
+        {
+            scrypt_share_policy<Policy> lane(policy, i, 1, p);
+            if ( !ROMix(block, lane) )
+                return false;
+        }
+        return true;
+    }
+
+    bool Mix(Salsa20Block* block, progress_func progress)
+    {
+        scrypt_callback_policy<> policy(progress);
+        return Mix(block, policy);
+    }
+
+    // Phase 2 pass of ROMix for both lanes, rolling both sparse entries forward together for
+    // as long as both need it
+    static inline void IntegerifyStep2(scrypt_mixer& a, const Salsa20Block* in_a, Salsa20Block* out_a, scrypt_mixer& b, const Salsa20Block* in_b, Salsa20Block* out_b)
+    {
+        uint32_t ja = in_a[(r*2)-1].entry[0].as_word32 % N;
+        uint32_t jb = in_b[(r*2)-1].entry[0].as_word32 % N;
+        const Salsa20Block *va, *vb;
+        uint32_t ka = a.NearestV(ja, va);
+        uint32_t kb = b.NearestV(jb, vb);
+        for (; ka > 0 && kb > 0; ka--, kb--)
+        {
+            Salsa20Block* next_a = a.NextLocalV(va);
+            Salsa20Block* next_b = b.NextLocalV(vb);
+            MixStep2(va, next_a, vb, next_b);
+            a.CacheV(ja - ka + 1, next_a);
+            b.CacheV(jb - kb + 1, next_b);
+            va = next_a;
+            vb = next_b;
+        }
+        for (; ka > 0; ka--)
+        {
+            Salsa20Block* next_a = a.NextLocalV(va);
+            MixStep(va, next_a);
+            a.CacheV(ja - ka + 1, next_a);
+            va = next_a;
+        }
+        for (; kb > 0; kb--)
+        {
+            Salsa20Block* next_b = b.NextLocalV(vb);
+            MixStep(vb, next_b);
+            b.CacheV(jb - kb + 1, next_b);
+            vb = next_b;
+        }
+
+        MixStep2(in_a, out_a, in_b, out_b, va, vb);
+    }
+
+    // ROMix on two lanes at once, each using the V array of its own mixer. Same steps
+    // as above, just alternating between the lanes
+    template<class Policy>
+    static bool ROMix2(scrypt_mixer& a, Salsa20Block* block_a, scrypt_mixer& b, Salsa20Block* block_b, Policy& policy)
+    {
+        if ( Policy::has_progress ) policy.progress(0);
+
+        // 1. X = B
+        a.LoadX(block_a);
+        b.LoadX(block_b);
+        a.ResetCache();
+        b.ResetCache();
+
+        // 2. Build V arrays
+        for(uint32_t i=0; i < N; i += 2)
+        {
+            if ( PolicyDue<Policy>(i) && policy.cancelled() )
+            {
+                a.Wipe();
+                b.Wipe();
+                return false;
+            }
+
+            a.KeepV(i, a.X);
+            b.KeepV(i, b.X);
+            MixStep2(a.X, a.T, b.X, b.T);
+            a.KeepV(i+1, a.T);
+            b.KeepV(i+1, b.T);
+            MixStep2(a.T, a.X, b.T, b.X);
+        }
+
+        StoreVDone();
+        if ( Policy::has_progress ) policy.progress(5);
+
+        // 3. Perform integerify mix loop
+        for (uint32_t i = 0; i < N; i += 2)
+        {
+            if ( PolicyDue<Policy>(i) )
+            {
+                if ( policy.cancelled() )
+                {
+                    a.Wipe();
+                    b.Wipe();
+                    return false;
+                }
+                if ( Policy::has_progress ) policy.progress( 5 + ( i * 95 / N ));
+            }
+
+            IntegerifyStep2(a, a.X, a.T, b, b.X, b.T);
+            IntegerifyStep2(a, a.T, a.X, b, b.T, b.X);
+        }
+
+        // 4. X = B'
+        a.StoreX(block_a);
+        b.StoreX(block_b);
+        return true;
+    }
+
+    static bool ROMix2(scrypt_mixer& a, Salsa20Block* block_a, scrypt_mixer& b, Salsa20Block* block_b, progress_func progress)
+    {
+        scrypt_callback_policy<> policy(progress);
+        return ROMix2(a, block_a, b, block_b, policy);
+    }
+
+    // Mix with the lanes taken in pairs through ROMix2, any odd one out goes through a
+    template<class Policy>
+    static bool MixInterleaved(scrypt_mixer& a, scrypt_mixer& b, Salsa20Block* block, Policy& policy)
+    {
+        uint32_t i=0;
+        for(; i+1<p; i+=2, block += r*4)
+        {
+            scrypt_share_policy<Policy> lanes(policy, i, 2, p);
+            if ( !ROMix2(a, block, b, block + r*2, lanes) )
+                return false;
+        }
+        if ( i < p )
+        {
+            scrypt_share_policy<Policy> lane(policy, i, 1, p);
+            return a.ROMix(block, lane);
+        }
+        return true;
+    }
+
+    static bool MixInterleaved(scrypt_mixer& a, scrypt_mixer& b, Salsa20Block* block, progress_func progress)
+    {
+        scrypt_callback_policy<> policy(progress);
+        return MixInterleaved(a, b, block, policy);
+    }
+
+#ifndef ARDUINO
+    // Mix with each lane's ROMix on a worker thread with a mixer of its own. The lanes report
+    // progress into their own slot and the calling thread turns that into a single figure
+    // for progress, so the policy is never told anything from a worker and progress never goes
+    // backwards. Each lane gets `global_size` bytes of `global_buffer` for its global tier.
+    // `heap_short` is set if any lane's mixer got less heap than asked for, which the lanes
+    // only report themselves if `report` is set
+    template<class Policy>
+    static bool MixThreaded(Salsa20Block* block, Policy& policy, uint32_t heap_size = heap_allocation, Salsa20Block* global_buffer = 0, uint32_t global_size = 0, bool* heap_short = 0, bool report = true)
+    {
+        std::atomic<uint8_t>    lane_percent[p];
+        std::atomic<uint32_t>   lanes_running(p);
+        std::atomic<bool>       cancelled(false);
+        std::atomic<bool>       lane_short(false);
+        std::mutex              lock;
+        std::condition_variable finished;
+        std::thread             workers[p];
+
+        for(uint32_t i=0; i<p; i++)
+        {
+            lane_percent[i] = 0;
+            workers[i] = std::thread( [&, i] () {
+                Salsa20Block* lane_global = ( global_buffer != 0 ) ? global_buffer + i*( global_size / sizeof(Salsa20Block) ) : 0;
+                scrypt_mixer mixer(lane_global, global_size, heap_size);
+                if ( mixer.heap_short() )
+                    lane_short = true;
+                if ( report )
+                    mixer.ReportHeapShort();
+                scrypt_lane_policy<Policy> lane(policy, lane_percent[i]);
+                if ( !mixer.ROMix(block + i*r*2, lane) )
+                    cancelled = true;
+                std::lock_guard<std::mutex> guard(lock);
+                lanes_running--;
+                finished.notify_one();
             });
+        }
+
+        uint8_t reported = 0;
+        if ( Policy::has_progress ) policy.progress(0);
+        std::unique_lock<std::mutex> guard(lock);
+        while ( lanes_running > 0 )
+        {
+            finished.wait_for(guard, std::chrono::milliseconds(SCRYPT_THREAD_PROGRESS_MS));
+            if ( !Policy::has_progress )
+                continue;
+            uint32_t total = 0;
+            for(uint32_t i=0; i<p; i++)
+                total += lane_percent[i].load(std::memory_order_relaxed);
+            if ( total / p > reported )
+            {
+                reported = total / p;
+                policy.progress(reported);
+            }
+        }
+
+        guard.unlock();
+        for(uint32_t i=0; i<p; i++)
+            workers[i].join();
+        if ( heap_short != 0 )
+            *heap_short = lane_short;
+        return !cancelled;
+    }
+
+    static bool MixThreaded(Salsa20Block* block, progress_func progress, uint32_t heap_size = heap_allocation, Salsa20Block* global_buffer = 0, uint32_t global_size = 0)
+    {
+        scrypt_callback_policy<> policy(progress);
+        return MixThreaded(block, policy, heap_size, global_buffer, global_size);
     }
+#endif
 
 private:
     Salsa20Block    m_stack_buffer[stack_allocation/sizeof(Salsa20Block)];
@@ -271,10 +902,22 @@ private:
     Salsa20Block    X[r*2];
     Salsa20Block    T[r*2];
     Salsa20Block    LocalV[r*2];
+    Salsa20Block    Spare[r*2];
     uint32_t        sparse_v_global_blocks;
     uint32_t        sparse_v_malloc_blocks;
+    uint32_t        m_wanted_malloc_blocks;
     uint32_t        sparse_v_stack_blocks;
     uint32_t        sparse_factor;
+    uint32_t        sparse_shift;
+    uint32_t        sparse_mask;
+    bool            sparse_pow2;
+    Salsa20Block*   m_v_base;
+    Salsa20Block**  m_v_table;
+    uint32_t*       m_cache_tags;
+    bool            m_cache_enabled;
+    // Where a stepped ROMix has got to, 0 to N-1 building V and N to 2N-1 mixing
+    uint32_t        m_romix_step;
+    scrypt_mixer_stats m_stats;
 };
 
 #endif
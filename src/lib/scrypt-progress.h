@@ -0,0 +1,153 @@
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  scrypt-progress.h - Progress and cancellation policies for scrypt
+//
+//      The mix used to call a progress_func on every pass of phase 2, which for MPW is over
+//      65k indirect calls a login, nearly all of them to say the same percentage again. The
+//      mixer now takes a policy as a template parameter instead and only looks at it every
+//      `stride` ROMix iterations. A policy says, at compile time, whether it wants progress
+//      and whether it can cancel, so with scrypt_quiet_policy all of it compiles away.
+//      A policy has
+//
+//          has_progress        false and the mix never works out a percentage
+//          can_cancel          false and the mix never asks whether to stop
+//          stride              ROMix iterations between looks at the policy, a power of 2
+//          cancelled()         true to make the mix stop, wiping everything it had
+//          progress(percent)   how much of the whole mix is done
+//
+//  Copyright (C) 2020, Gazoodle (https://github.com/gazoodle)
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef _inc_scrypt_progress_h
+#define _inc_scrypt_progress_h
+
+#include <stdint.h>
+#include <functional>
+#ifndef ARDUINO
+#include <atomic>
+#endif
+
+typedef std::function<void (uint8_t percent)> progress_func;
+
+// Default ROMix iterations between looks at the policy
+#ifndef SCRYPT_PROGRESS_STRIDE
+#define SCRYPT_PROGRESS_STRIDE      (256)
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Cancel from another thread, or from inside a progress callback, to make a hash give up
+class scrypt_cancel_token
+{
+public:
+    scrypt_cancel_token(void) : m_cancelled(false) {}
+
+    void cancel(void) { m_cancelled = true; }
+    void reset(void) { m_cancelled = false; }
+    bool is_cancelled(void) const { return m_cancelled; }
+
+private:
+#ifndef ARDUINO
+    std::atomic<bool>   m_cancelled;
+#else
+    volatile bool       m_cancelled;
+#endif
+};
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// No progress and no cancelling
+struct scrypt_quiet_policy
+{
+    static const bool       has_progress = false;
+    static const bool       can_cancel = false;
+    static const uint32_t   stride = SCRYPT_PROGRESS_STRIDE;
+
+    inline bool cancelled(void) const { return false; }
+    inline void progress(uint8_t percent) {}
+};
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// A progress_func, only called when the whole percentage changes, and a cancel token if
+// there is one
+template<uint32_t check_stride = SCRYPT_PROGRESS_STRIDE>
+class scrypt_callback_policy
+{
+public:
+    scrypt_callback_policy(progress_func func, const scrypt_cancel_token* cancel = 0) : m_func(func), m_cancel(cancel), m_last(0xff) {}
+
+    static const bool       has_progress = true;
+    static const bool       can_cancel = true;
+    static const uint32_t   stride = check_stride;
+
+    inline bool cancelled(void) const { return ( m_cancel != 0 ) && m_cancel->is_cancelled(); }
+    inline void progress(uint8_t percent)
+    {
+        if ( ( percent == m_last ) || !m_func )
+            return;
+        m_last = percent;
+        m_func(percent);
+    }
+
+private:
+    progress_func               m_func;
+    const scrypt_cancel_token*  m_cancel;
+    uint8_t                     m_last;
+};
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Some lanes out of the whole mix, reporting their progress as their share of it
+template<class Policy>
+class scrypt_share_policy
+{
+public:
+    scrypt_share_policy(Policy& policy, uint32_t first, uint32_t count, uint32_t total) : m_policy(policy), m_first(first), m_count(count), m_total(total) {}
+
+    static const bool       has_progress = Policy::has_progress;
+    static const bool       can_cancel = Policy::can_cancel;
+    static const uint32_t   stride = Policy::stride;
+
+    inline bool cancelled(void) const { return m_policy.cancelled(); }
+    inline void progress(uint8_t percent) { m_policy.progress( ( m_first * 100 + percent * m_count ) / m_total ); }
+
+private:
+    Policy&     m_policy;
+    uint32_t    m_first;
+    uint32_t    m_count;
+    uint32_t    m_total;
+};
+///////////////////////////////////////////////////////////////////////////////////////////////////
+#ifndef ARDUINO
+// A lane on a worker thread. Progress goes into a slot for the calling thread to gather up,
+// so the policy for the whole mix is only ever told from one thread. Cancelling is whatever
+// that policy says
+template<class Policy>
+class scrypt_lane_policy
+{
+public:
+    scrypt_lane_policy(const Policy& policy, std::atomic<uint8_t>& slot) : m_policy(policy), m_slot(slot) {}
+
+    static const bool       has_progress = Policy::has_progress;
+    static const bool       can_cancel = Policy::can_cancel;
+    static const uint32_t   stride = Policy::stride;
+
+    inline bool cancelled(void) const { return m_policy.cancelled(); }
+    inline void progress(uint8_t percent) { m_slot.store(percent, std::memory_order_relaxed); }
+
+private:
+    const Policy&           m_policy;
+    std::atomic<uint8_t>&   m_slot;
+};
+#endif
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif
@@ -31,36 +31,149 @@
 
 #define SCRYPT_YIELD_FREQUENCY      (64)
 
+// Hosts have the memory to spare for a V array per lane, MCUs would rather spend it on
+// a less sparse V
+#ifndef SCRYPT_DEFAULT_LANE_MODE
+#ifdef ARDUINO
+#define SCRYPT_DEFAULT_LANE_MODE    SCRYPT_LANES_SEQUENTIAL
+#else
+#define SCRYPT_DEFAULT_LANE_MODE    SCRYPT_LANES_INTERLEAVED
+#endif
+#endif
+
 #if defined(ARDUINO_TEENSY40) || defined(ARDUINO_TEENSY41)
 extern "C" uint8_t external_psram_size;
 #endif
 
+// Things that went less well than they might have during a hash, see scrypt::get_warnings
+#define SCRYPT_WARN_GLOBAL_MAP      (0x01)      // Couldn't map the global tier's file, used the heap
+#define SCRYPT_WARN_HEAP_SHORT      (0x02)      // Got less heap than asked for, V is sparser
+
+// Runtime choices for how scrypt goes about the mix
+struct scrypt_options
+{
+#ifndef ARDUINO
+    scrypt_options(void) : lane_mode(SCRYPT_DEFAULT_LANE_MODE), memory_budget(0), quiet(false), global_size(0), global_file(0) {}
+#else
+    scrypt_options(void) : lane_mode(SCRYPT_DEFAULT_LANE_MODE), memory_budget(0), quiet(false) {}
+#endif
+
+    // See scrypt_lane_mode
+    scrypt_lane_mode    lane_mode;
+    // Most bytes of V array to use across all the lanes, or 0 for the platform's usual amount.
+    // Less memory means a sparser V and more recomputation in the second phase of ROMix. It
+    // counts every tier, on a Teensy without PSRAM that's the local tier (see scrypt-impl.h)
+    // before the heap
+    uint32_t            memory_budget;
+    // Keep warnings out of IO and leave them to get_warnings(), for a hash on a thread that
+    // mustn't write to IO
+    bool                quiet;
+#ifndef ARDUINO
+    // Bytes of V array to keep in a memory mapped file across all the lanes, like the PSRAM
+    // global tier on a Teensy 4.1. When this is set the heap tier only gets memory_budget
+    // (none if that's 0), the rest of V lives in the file
+    uint32_t            global_size;
+    // Where the global tier's file goes, a directory for an unnamed temporary file or a path
+    // whose name each hash's private file is made from. NULL or empty for an anonymous memfd
+    const char *        global_file;
+#endif
+};
+
 template<uint32_t N, uint32_t r, uint32_t p, uint32_t dkLen>
 class scrypt
 {
 private:
     scrypt(const scrypt& other) {}
 public:
-    scrypt() : m_final(0) {}
+    scrypt() : m_final(0), m_step_initial(0), m_step_mixer(0), m_step_passphrase(0), m_step_passphrase_size(0), m_step_lane(0), m_warnings(0)
+#if defined(ARDUINO_TEENSY40) || defined(ARDUINO_TEENSY41)
+        , m_step_local_tier(false)
+#endif
+    {}
     ~scrypt() { Reset(); }
 
-    const uint8_t * hash( const uint8_t * passphrase, uint32_t passphrase_size, const uint8_t * salt, uint32_t salt_size, progress_func progress);
+    // `progress` is only called when the whole percentage changes. If `cancel` is given and
+    // gets cancelled the hash stops, wipes what it had and returns NULL
+    const uint8_t * hash( const uint8_t * passphrase, uint32_t passphrase_size, const uint8_t * salt, uint32_t salt_size, progress_func progress, const scrypt_cancel_token * cancel = 0)
+    {
+        scrypt_callback_policy<> policy(progress, cancel);
+        return hash(passphrase, passphrase_size, salt, salt_size, policy);
+    }
+    // As above with a progress policy (see scrypt-progress.h), scrypt_quiet_policy for none
+    template<class Policy>
+    const uint8_t * hash( const uint8_t * passphrase, uint32_t passphrase_size, const uint8_t * salt, uint32_t salt_size, Policy& policy);
     // Convenience function
     const uint8_t * hash( const char * passphrase, const char * salt, progress_func progress)
     {
         return hash(reinterpret_cast<const uint8_t *>(passphrase), strlen(passphrase), reinterpret_cast<const uint8_t *>(salt), strlen(salt), progress);
     }
 
+    // The same hash a slice at a time, for a caller with other things to get on with (serial
+    // input, say) that can't wait for all of it. begin() starts it off, then every step() does
+    // about `max_blockmix` BlockMix steps worth of the mix and returns done(). V gets the
+    // same tiers, and so the same sparse factor, as hash() with the lanes mixed one after
+    // another, which is how step() mixes them whatever the lane mode. V has to last from one
+    // step to the next, so none of it is on the stack, on a Teensy the part that would be is
+    // in a static array instead. `progress` gets called from step()
+    void begin( const uint8_t * passphrase, uint32_t passphrase_size, const uint8_t * salt, uint32_t salt_size, progress_func progress = 0);
+    bool step(uint32_t max_blockmix);
+    bool done(void) const { return m_final != 0; }
+    // The hash once it's done, NULL until then
+    const uint8_t * result(void) const { return done() ? m_final->result() : 0; }
+
     void Reset(void);
+    // SCRYPT_WARN_ flags for the last hash, or the one begin() started, until Reset
+    uint8_t get_warnings(void) const { return m_warnings; }
+
+#ifndef ARDUINO
+    // Get the V arrays this lane mode needs into the arena ahead of time
+    void prewarm(void);
+#endif
+
+    void set_options(const scrypt_options& options) { m_options = options; }
+    const scrypt_options& get_options(void) const { return m_options; }
+    // Choose how the p lanes get mixed, see scrypt_lane_mode
+    void set_lane_mode(scrypt_lane_mode mode) { m_options.lane_mode = mode; }
+    scrypt_lane_mode get_lane_mode(void) const { return m_options.lane_mode; }
+    // Number of V arrays in use at once with the current lane mode
+    uint32_t concurrent_lanes(void) const;
 
 private:
+
 #if defined(ARDUINO_TEENSY40) || defined(ARDUINO_TEENSY41)
-    inline void GlobalMixer(Salsa20Block* block, progress_func progress, uint32_t global_size);
-    void StackAndMallocMixer(Salsa20Block* block, progress_func progress);
+    template<class Policy>
+    inline bool GlobalMixer(Salsa20Block* block, Policy& policy, uint32_t global_size);
+    template<class Policy>
+    bool StackAndMallocMixer(Salsa20Block* block, Policy& policy, uint8_t& warnings);
+    // How much of the local tier and the heap V gets when there's no PSRAM, within the budget
+    void TeensyTiers(bool have_local, uint32_t& local_size, uint32_t& heap_size) const;
 #endif
+    void FinalHash(const uint8_t * passphrase, uint32_t passphrase_size, const uint8_t * second_salt);
+
+    // begin() and step() keep their V in a mixer with no stack tier, anything that would be
+    // on the stack goes in its global tier
+    typedef scrypt_mixer<N,r,p,dkLen,0,0> step_mixer;
+    step_mixer* NewStepMixer(void);
+    // SCRYPT_WARN_HEAP_SHORT if `mixer` is short of heap, said out loud unless quiet
+    template<class Mixer>
+    uint8_t CheckHeap(const Mixer& mixer) const;
+    void ClearStep(void);
 
 private:
     PBKDF2<HMAC<SHA256>,dkLen>* m_final;
+    scrypt_options              m_options;
+    // Where begin() and step() have got to
+    PBKDF2<HMAC<SHA256>,p*128*r>*   m_step_initial;
+    step_mixer*                 m_step_mixer;
+    uint8_t*                    m_step_passphrase;
+    uint32_t                    m_step_passphrase_size;
+    uint32_t                    m_step_lane;
+    progress_func               m_step_progress;
+    uint8_t                     m_warnings;
+#if defined(ARDUINO_TEENSY40) || defined(ARDUINO_TEENSY41)
+    // The step mixer has the local tier, see scrypt_local_tier
+    bool                        m_step_local_tier;
+#endif
 };
 
 #include "scrypt-impl.h"
@@ -28,22 +28,35 @@ inline SHA256::SHA256(const uint8_t *message, uint32_t message_size ) : SHA256()
     enqueue(message, message_size);
 }
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-inline void SHA256::reset(void)
+inline const uint32_t * SHA256::initial_state(void)
 {
-    // Rewind everything so we can start a new digest
-    m_message_size = 0;
-
     // Initialize hash values
     // First 32bits on the fractional parts of the square roots on the first 8 primes 2..19
-    uint32_t * hash_buffer = reinterpret_cast<uint32_t *>(m_hash_buffer);
-    hash_buffer[0] = 0x6a09e667;
-    hash_buffer[1] = 0xbb67ae85;
-    hash_buffer[2] = 0x3c6ef372;
-    hash_buffer[3] = 0xa54ff53a;
-    hash_buffer[4] = 0x510e527f;
-    hash_buffer[5] = 0x9b05688c;
-    hash_buffer[6] = 0x1f83d9ab;
-    hash_buffer[7] = 0x5be0cd19;
+    static const uint32_t h[STATE_SIZE_WORDS] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    return h;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline void SHA256::reset(void)
+{
+    // Rewind everything so we can start a new digest
+    set_midstate(initial_state(), 0);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline void SHA256::set_midstate(const uint32_t * state, uint32_t message_size)
+{
+    m_message_size = message_size;
+    memcpy( m_hash_buffer, state, sizeof(m_hash_buffer) );
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline void SHA256::copy_from(const SHA256& other)
+{
+    m_message_size = other.m_message_size;
+    memcpy( m_hash_buffer, other.m_hash_buffer, sizeof(m_hash_buffer) );
+    // Only the words holding bytes of the current chunk matter
+    uint32_t pending = ( ( m_message_size & SHA256_MESSAGE_SCHEDULE_SIZE_MASK ) + 3 ) & ~3;
+    memcpy( m_message_schedule_array, other.m_message_schedule_array, pending );
 }
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 inline void SHA256::enqueue(uint8_t byte)
@@ -62,6 +75,23 @@ inline void SHA256::enqueue(uint8_t byte)
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 inline void SHA256::enqueue(const uint8_t *bytes, uint32_t count)
 {
+    // Byte at a time until we're lined up with the start of a chunk
+    while( ( count > 0 ) && ( ( m_message_size & SHA256_MESSAGE_SCHEDULE_SIZE_MASK ) != 0 ) )
+    {
+        enqueue(*bytes++);
+        count--;
+    }
+    // Whole chunks can go straight into the message schedule as big-endian words
+    // without going through the byte scatter
+    while( count >= BLOCK_SIZE_BYTES )
+    {
+        for(uint8_t i=0; i<BLOCK_SIZE_BYTES/4; i++, bytes += 4)
+            m_message_schedule_array[i] = LOAD_BE32(bytes);
+        m_message_size += BLOCK_SIZE_BYTES;
+        count -= BLOCK_SIZE_BYTES;
+        hash_chunk();
+    }
+    // And whatever is left over
     while(count--)
         enqueue(*bytes++);
 }
@@ -94,20 +124,8 @@ inline void SHA256::finalize(void)
     enqueue(current_message_size<<3);
 }
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-inline void SHA256::hash_chunk(void)
+inline const uint32_t * SHA256::round_constants(void)
 {
-    uint32_t * hash_buffer = reinterpret_cast<uint32_t *>(m_hash_buffer);
-
-    // Collect working variables
-    uint32_t a=hash_buffer[0];
-    uint32_t b=hash_buffer[1];
-    uint32_t c=hash_buffer[2];
-    uint32_t d=hash_buffer[3];
-    uint32_t e=hash_buffer[4];
-    uint32_t f=hash_buffer[5];
-    uint32_t g=hash_buffer[6];
-    uint32_t h=hash_buffer[7];
-
     // Initialize array of round constants:
     // First 32 bits of the fractional parts of the cube roots of the first 64 primes 2..311
     static const uint32_t k[64] = {
@@ -120,20 +138,54 @@ inline void SHA256::hash_chunk(void)
         0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
         0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
     };
+    return k;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline void SHA256::hash_chunk(void)
+{
+    hash_chunk(reinterpret_cast<uint32_t *>(m_hash_buffer), m_message_schedule_array);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline void SHA256::hash_chunk(uint32_t * hash_buffer, uint32_t * message_schedule_array)
+{
+#ifdef EMPW_X86
+    // Use the SHA extensions if this CPU has them
+    if ( cpu_has_sha_ni() )
+    {
+        sha256_shani_hash_chunk(hash_buffer, message_schedule_array, round_constants());
+        return;
+    }
+#endif
+    hash_chunk_portable(hash_buffer, message_schedule_array);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline void SHA256::hash_chunk_portable(uint32_t * hash_buffer, uint32_t * message_schedule_array)
+{
+    // Collect working variables
+    uint32_t a=hash_buffer[0];
+    uint32_t b=hash_buffer[1];
+    uint32_t c=hash_buffer[2];
+    uint32_t d=hash_buffer[3];
+    uint32_t e=hash_buffer[4];
+    uint32_t f=hash_buffer[5];
+    uint32_t g=hash_buffer[6];
+    uint32_t h=hash_buffer[7];
+
+    const uint32_t * k = round_constants();
 
     for( uint8_t idx=0; idx<SHA256_MESSAGE_SCHEDULE_SIZE; idx++ )
     {
         if ( idx >= BLOCK_SIZE_BYTES/4 )
         {
             // Extend the first 16 words into the remaining 48 words w[16..63] of the message schedule array:                
-            uint32_t s0 = RR(m_message_schedule_array[idx-15], 7) ^ RR(m_message_schedule_array[idx-15], 18) ^ (m_message_schedule_array[idx-15]>>3);
-            uint32_t s1 = RR(m_message_schedule_array[idx-2], 17) ^ RR(m_message_schedule_array[idx-2], 19) ^ (m_message_schedule_array[idx-2]>>10);
-            m_message_schedule_array[idx] = m_message_schedule_array[idx-16] + s0 + m_message_schedule_array[idx-7] + s1;
+            uint32_t s0 = RR(message_schedule_array[idx-15], 7) ^ RR(message_schedule_array[idx-15], 18) ^ (message_schedule_array[idx-15]>>3);
+            uint32_t s1 = RR(message_schedule_array[idx-2], 17) ^ RR(message_schedule_array[idx-2], 19) ^ (message_schedule_array[idx-2]>>10);
+            message_schedule_array[idx] = message_schedule_array[idx-16] + s0 + message_schedule_array[idx-7] + s1;
         }
 
         uint32_t S1 = RR(e, 6) ^ RR(e, 11) ^ RR(e, 25);
         uint32_t ch = (e & f) ^ (~e & g);
-        uint32_t temp1 = h + S1 + ch + k[idx] + m_message_schedule_array[idx];
+        uint32_t temp1 = h + S1 + ch + k[idx] + message_schedule_array[idx];
         uint32_t S0 = RR(a, 2) ^ RR(a, 13) ^ RR(a, 22);
         uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
         uint32_t temp2 = S0 + maj;
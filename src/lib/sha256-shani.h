@@ -0,0 +1,89 @@
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  SHA-256 compression using the Intel SHA extensions
+//
+//      Drop in replacement for the portable compression loop in SHA256::hash_chunk. The
+//      sha256rnds2 instruction performs two rounds at a time on the state held as ABEF/CDGH
+//      register pairs, while sha256msg1/sha256msg2 extend the message schedule four words
+//      at a time. The message words arrive already as native integers (the enqueue code
+//      does the big-endian conversion), so unlike most implementations there is no byte
+//      shuffle on load.
+//
+//  References
+//      https://software.intel.com/content/www/us/en/develop/articles/intel-sha-extensions.html
+//      https://github.com/noloader/SHA-Intrinsics
+//
+//  Copyright (C) 2020, Gazoodle (https://github.com/gazoodle)
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef _inc_sha256_shani_h
+#define _inc_sha256_shani_h
+
+#include "cpu.h"
+
+#ifdef EMPW_X86
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+__attribute__((target("sha,sse4.1,ssse3")))
+inline void sha256_shani_hash_chunk(uint32_t * hash, const uint32_t * message, const uint32_t * k)
+{
+    // Rearrange the hash words into the ABEF/CDGH layout the instructions want
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(&hash[0])), 0xB1);     // CDAB
+    __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(&hash[4])), 0x1B);  // EFGH
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);                                                       // ABEF
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);                                                            // CDGH
+
+    const __m128i abef_save = state0;
+    const __m128i cdgh_save = state1;
+
+    __m128i msg[4];
+    for( uint8_t i=0; i<4; i++ )
+        msg[i] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&message[i*4]));
+
+    // 16 groups of 4 rounds. Each group consumes the 4 schedule words in msg[i&3] while the
+    // schedule for group i+1 is completed (msg2) and group i+3 is started (msg1)
+    #pragma GCC unroll 16
+    for( uint8_t i=0; i<16; i++ )
+    {
+        __m128i wk = _mm_add_epi32(msg[i&3], _mm_loadu_si128(reinterpret_cast<const __m128i *>(&k[i*4])));
+        state1 = _mm_sha256rnds2_epu32(state1, state0, wk);
+        if ( ( i >= 3 ) && ( i < 15 ) )
+        {
+            tmp = _mm_alignr_epi8(msg[i&3], msg[(i-1)&3], 4);
+            msg[(i+1)&3] = _mm_sha256msg2_epu32(_mm_add_epi32(msg[(i+1)&3], tmp), msg[i&3]);
+        }
+        wk = _mm_shuffle_epi32(wk, 0x0E);
+        state0 = _mm_sha256rnds2_epu32(state0, state1, wk);
+        if ( ( i >= 1 ) && ( i < 13 ) )
+            msg[(i-1)&3] = _mm_sha256msg1_epu32(msg[(i-1)&3], msg[i&3]);
+    }
+
+    // Add the compressed chunk to the current hash value
+    state0 = _mm_add_epi32(state0, abef_save);
+    state1 = _mm_add_epi32(state1, cdgh_save);
+
+    // And put it back in ABCD/EFGH order
+    tmp = _mm_shuffle_epi32(state0, 0x1B);                                                                  // FEBA
+    state1 = _mm_shuffle_epi32(state1, 0xB1);                                                               // DCHG
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(&hash[0]), _mm_blend_epi16(tmp, state1, 0xF0));             // DCBA
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(&hash[4]), _mm_alignr_epi8(state1, tmp, 8));                // HGFE
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif
+
+#endif
@@ -27,6 +27,7 @@
 #include <string.h>
 #include <limits.h>
 #include "io.h"
+#include "sha256-shani.h"
 
 #define SHA256_MESSAGE_SCHEDULE_SIZE        64              // Compression algorithm buffer
 #define SHA256_MESSAGE_SCHEDULE_SIZE_MASK   (SHA256_MESSAGE_SCHEDULE_SIZE-1)
@@ -34,6 +35,7 @@
 #define RR(v,n)             (((v)<<(32-(n))) | ((v)>>(n)))
 #define RL(v,n)             (((v)<<(n)) | ((v)>>(32-(n))))
 #define SWAP_ENDS(u32)      ((( (u32) & 0xff000000 ) >> 24 ) | (((u32) & 0x00ff0000 ) >> 8 ) | (((u32) & 0x0000ff00 ) << 8 ) | (((u32) & 0x000000ff ) << 24 ))
+#define LOAD_BE32(p)        ( ((uint32_t)(p)[0] << 24 ) | ((uint32_t)(p)[1] << 16 ) | ((uint32_t)(p)[2] << 8 ) | ((uint32_t)(p)[3]) )
 #define countof(x)          ( (sizeof(x)) / (sizeof(x[0])) )
 
 class SHA256
@@ -49,6 +51,7 @@ public:
 
     static const uint8_t    BLOCK_SIZE_BYTES = 64;
     static const uint8_t    HASH_SIZE_BYTES = 32;
+    static const uint8_t    STATE_SIZE_WORDS = 8;
 
 public:
     void reset(void);
@@ -58,7 +61,21 @@ public:
 
     const uint8_t * digest(void);
 
+    // Midstate support. The state is only meaningful when a whole number of chunks have been enqueued
+    const uint32_t * get_midstate(void) const { return reinterpret_cast<const uint32_t *>(m_hash_buffer); }
+    void set_midstate(const uint32_t * state, uint32_t message_size);
+    // Take over the complete state of another hash, including any partially filled chunk
+    void copy_from(const SHA256& other);
+
+    // Raw compression building blocks, shared with the multi-buffer hasher and PBKDF2
+    static const uint32_t * initial_state(void);
+    static const uint32_t * round_constants(void);
+    static void hash_chunk(uint32_t * hash_buffer, uint32_t * message_schedule_array);
+    static void hash_chunk_portable(uint32_t * hash_buffer, uint32_t * message_schedule_array);
+
+#ifndef TEST_SUITE
 private:
+#endif
     void hash_chunk(void);
     void finalize(void);
 
@@ -0,0 +1,205 @@
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  Multi-buffer SHA-256 implementation
+//
+//  References
+//      https://tools.ietf.org/html/rfc6234
+//      https://www.intel.com/content/dam/www/public/us/en/documents/white-papers/communications-ia-multi-buffer-paper.pdf
+//
+//  Copyright (C) 2020, Gazoodle (https://github.com/gazoodle)
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline void SHA256x8::hash(uint8_t count, const uint8_t * const * messages, const uint32_t * message_sizes, const uint32_t * midstate, uint32_t prefix_size )
+{
+    if ( midstate == NULL )
+        midstate = SHA256::initial_state();
+
+    // Work out how many chunks each lane needs once padded (0x80 marker and 64 bit length)
+    uint32_t chunks[LANES];
+    uint32_t max_chunks = 0;
+    for(uint8_t lane=0; lane<LANES; lane++)
+    {
+        chunks[lane] = ( lane < count ) ? ( message_sizes[lane] + 9 + BLOCK_SIZE_BYTES - 1 ) / BLOCK_SIZE_BYTES : 0;
+        if ( chunks[lane] > max_chunks )
+            max_chunks = chunks[lane];
+        for(uint8_t i=0; i<SHA256::STATE_SIZE_WORDS; i++)
+            m_state[i][lane] = midstate[i];
+    }
+
+    for(uint32_t chunk=0; chunk<max_chunks; chunk++)
+    {
+        for(uint8_t lane=0; lane<LANES; lane++)
+        {
+            if ( chunk < chunks[lane] )
+                load_chunk(lane, messages[lane], message_sizes[lane], chunk, prefix_size + message_sizes[lane]);
+            else
+                for(uint8_t i=0; i<BLOCK_SIZE_BYTES/4; i++)
+                    m_schedule[i][lane] = 0;
+        }
+
+        hash_chunks();
+
+        // Lanes that have just finished get their hash collected before the next chunk trashes it
+        for(uint8_t lane=0; lane<count; lane++)
+        {
+            if ( chunk + 1 != chunks[lane] )
+                continue;
+            for(uint8_t i=0; i<SHA256::STATE_SIZE_WORDS; i++)
+            {
+                uint32_t v = m_state[i][lane];
+                m_digests[lane][i*4+0] = v >> 24;
+                m_digests[lane][i*4+1] = v >> 16;
+                m_digests[lane][i*4+2] = v >> 8;
+                m_digests[lane][i*4+3] = v;
+            }
+        }
+    }
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline void SHA256x8::load_chunk(uint8_t lane, const uint8_t * message, uint32_t message_size, uint32_t chunk, uint32_t total_size)
+{
+    uint8_t buffer[BLOCK_SIZE_BYTES];
+    uint32_t offset = chunk * BLOCK_SIZE_BYTES;
+
+    if ( offset + BLOCK_SIZE_BYTES <= message_size )
+    {
+        // Chunk is all message
+        memcpy( buffer, &message[offset], BLOCK_SIZE_BYTES );
+    }
+    else
+    {
+        // Some, or none of the message, followed by the padding
+        memset( buffer, 0, sizeof(buffer) );
+        uint32_t used = ( offset < message_size ) ? message_size - offset : 0;
+        if ( used > 0 )
+            memcpy( buffer, &message[offset], used );
+        if ( offset + used == message_size )
+            buffer[used] = 0x80;
+        // Only the last chunk carries the bit count
+        if ( offset + BLOCK_SIZE_BYTES >= message_size + 9 )
+        {
+            buffer[59] = total_size >> 29;
+            buffer[60] = total_size >> 21;
+            buffer[61] = total_size >> 13;
+            buffer[62] = total_size >> 5;
+            buffer[63] = total_size << 3;
+        }
+    }
+
+    for(uint8_t i=0; i<BLOCK_SIZE_BYTES/4; i++)
+        m_schedule[i][lane] = LOAD_BE32(&buffer[i*4]);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline void SHA256x8::hash_chunks(void)
+{
+#ifdef EMPW_X86
+    if ( cpu_has_avx2() )
+    {
+        hash_chunks_avx2(m_state, m_schedule);
+    }
+    else
+    {
+        hash_chunks_sse2(m_state, m_schedule, 0);
+        hash_chunks_sse2(m_state, m_schedule, 4);
+    }
+#else
+    hash_chunks_portable(m_state, m_schedule);
+#endif
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline void SHA256x8::hash_chunks_portable(uint32_t (*state)[LANES], uint32_t (*schedule)[LANES])
+{
+    // One lane at a time through the ordinary compression
+    for(uint8_t lane=0; lane<LANES; lane++)
+    {
+        uint32_t hash[SHA256::STATE_SIZE_WORDS];
+        uint32_t message[SHA256_MESSAGE_SCHEDULE_SIZE];
+        for(uint8_t i=0; i<SHA256::STATE_SIZE_WORDS; i++)
+            hash[i] = state[i][lane];
+        for(uint8_t i=0; i<BLOCK_SIZE_BYTES/4; i++)
+            message[i] = schedule[i][lane];
+        SHA256::hash_chunk_portable(hash, message);
+        for(uint8_t i=0; i<SHA256::STATE_SIZE_WORDS; i++)
+            state[i][lane] = hash[i];
+    }
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+#ifdef EMPW_X86
+
+typedef uint32_t sha256_u32x4 __attribute__((vector_size(16)));
+typedef uint32_t sha256_u32x8 __attribute__((vector_size(32)));
+
+// The same compression as SHA256::hash_chunk_portable, except every variable is a vector
+// with one message per lane. Instantiated once per vector width by the target specific
+// wrappers below, so the compiler generates SSE2 or AVX2 code as appropriate.
+template<class V>
+__attribute__((always_inline)) inline void sha256xN_hash_chunks(uint32_t (*state)[SHA256X8_LANES], uint32_t (*schedule)[SHA256X8_LANES], uint8_t first_lane)
+{
+    V w[SHA256_MESSAGE_SCHEDULE_SIZE];
+    V h[SHA256::STATE_SIZE_WORDS];
+    const uint32_t * k = SHA256::round_constants();
+
+    for(uint8_t i=0; i<SHA256::STATE_SIZE_WORDS; i++)
+        memcpy( &h[i], &state[i][first_lane], sizeof(V) );
+    for(uint8_t i=0; i<16; i++)
+        memcpy( &w[i], &schedule[i][first_lane], sizeof(V) );
+
+    V a=h[0], b=h[1], c=h[2], d=h[3], e=h[4], f=h[5], g=h[6], hh=h[7];
+
+    for( uint8_t idx=0; idx<SHA256_MESSAGE_SCHEDULE_SIZE; idx++ )
+    {
+        if ( idx >= 16 )
+        {
+            V s0 = RR(w[idx-15], 7) ^ RR(w[idx-15], 18) ^ (w[idx-15]>>3);
+            V s1 = RR(w[idx-2], 17) ^ RR(w[idx-2], 19) ^ (w[idx-2]>>10);
+            w[idx] = w[idx-16] + s0 + w[idx-7] + s1;
+        }
+
+        V S1 = RR(e, 6) ^ RR(e, 11) ^ RR(e, 25);
+        V ch = (e & f) ^ (~e & g);
+        V temp1 = hh + S1 + ch + k[idx] + w[idx];
+        V S0 = RR(a, 2) ^ RR(a, 13) ^ RR(a, 22);
+        V maj = (a & b) ^ (a & c) ^ (b & c);
+        V temp2 = S0 + maj;
+
+        hh = g;
+        g = f;
+        f = e;
+        e = d + temp1;
+        d = c;
+        c = b;
+        b = a;
+        a = temp1 + temp2;
+    }
+
+    h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+    h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
+    for(uint8_t i=0; i<SHA256::STATE_SIZE_WORDS; i++)
+        memcpy( &state[i][first_lane], &h[i], sizeof(V) );
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline void SHA256x8::hash_chunks_sse2(uint32_t (*state)[LANES], uint32_t (*schedule)[LANES], uint8_t first_lane)
+{
+    sha256xN_hash_chunks<sha256_u32x4>(state, schedule, first_lane);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+__attribute__((target("avx2")))
+inline void SHA256x8::hash_chunks_avx2(uint32_t (*state)[LANES], uint32_t (*schedule)[LANES])
+{
+    sha256xN_hash_chunks<sha256_u32x8>(state, schedule, 0);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+#endif
@@ -0,0 +1,77 @@
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  sha256x8.h - Header file for multi-buffer SHA256 implementation
+//
+//      Hashes up to eight independent messages at once by holding the working state of each
+//      message in its own lane of a vector register, so one pass of the compression loop
+//      advances all of them. On x86 hosts with AVX2 all eight lanes run in one pass, otherwise
+//      SSE2 does them four at a time. Embedded builds simply run the lanes one after another
+//      through the portable SHA256 compression.
+//
+//  Copyright (C) 2020, Gazoodle (https://github.com/gazoodle)
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef _inc_sha256x8_h
+#define _inc_sha256x8_h
+
+#include "sha256.h"
+#include "cpu.h"
+
+#define SHA256X8_LANES      8
+
+class SHA256x8
+{
+private:
+    SHA256x8(const SHA256x8& other) {}
+public:
+    SHA256x8(void) {}
+    ~SHA256x8(void) { memset( m_state, 0, sizeof(m_state) ); memset( m_schedule, 0, sizeof(m_schedule) ); memset( m_digests, 0, sizeof(m_digests) ); }
+
+    static const uint8_t    LANES = SHA256X8_LANES;
+    static const uint8_t    BLOCK_SIZE_BYTES = SHA256::BLOCK_SIZE_BYTES;
+    static const uint8_t    HASH_SIZE_BYTES = SHA256::HASH_SIZE_BYTES;
+
+public:
+    // Hash `count` (up to LANES) messages. Each lane starts from `midstate` after `prefix_size` bytes
+    // (a whole number of chunks), or from the standard initial hash when midstate is NULL. Messages
+    // may have different lengths, lanes that need fewer chunks simply finish early.
+    void hash(uint8_t count, const uint8_t * const * messages, const uint32_t * message_sizes, const uint32_t * midstate = NULL, uint32_t prefix_size = 0);
+    const uint8_t * digest(uint8_t lane) const { return m_digests[lane]; }
+
+#ifndef TEST_SUITE
+private:
+#endif
+    void load_chunk(uint8_t lane, const uint8_t * message, uint32_t message_size, uint32_t chunk, uint32_t total_size);
+    void hash_chunks(void);
+
+    // Compression kernels working on the transposed state and schedule
+    static void hash_chunks_portable(uint32_t (*state)[LANES], uint32_t (*schedule)[LANES]);
+#ifdef EMPW_X86
+    static void hash_chunks_sse2(uint32_t (*state)[LANES], uint32_t (*schedule)[LANES], uint8_t first_lane);
+    static void hash_chunks_avx2(uint32_t (*state)[LANES], uint32_t (*schedule)[LANES]);
+#endif
+
+private:
+    // Lane n of each message word lives in [word][n]
+    uint32_t    m_state[ SHA256::STATE_SIZE_WORDS ][ LANES ];
+    uint32_t    m_schedule[ SHA256_MESSAGE_SCHEDULE_SIZE ][ LANES ];
+    uint8_t     m_digests[ LANES ][ HASH_SIZE_BYTES ];
+};
+
+#include "sha256x8-impl.h"
+
+#endif
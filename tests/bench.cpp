@@ -0,0 +1,193 @@
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  bench.cpp - Host application for timing the MPW sized scrypt
+//
+//      Runs scrypt with MPW's parameters a few times each with and without huge pages behind
+//      the V array and reports how long the two ROMix phases took. Phase 1 fills V in order,
+//      phase 2 reads it at random, so phase 2 is the one that shows the difference the page
+//      size makes. The phases are told apart by the progress callback, which reports 5% as
+//      phase 1 finishes and 100% once it's all done.
+//
+//      It also runs a single ROMix lane with a few sparse V sizes to show how much replaying
+//      of BlockMix the recompute cache saves, and a full multi-buffer batch of master keys
+//      against the same keys done one at a time.
+//
+//      Last it times the runtime parameter scrypt_engine with MPW's parameters and asks it for
+//      the largest N that fits a few login latencies on this machine.
+//
+//  Copyright (C) 2020, Gazoodle (https://github.com/gazoodle)
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <time.h>
+#include <io.h>
+#include <mpw.h>
+#include <scrypt-batch.h>
+#include <scrypt-engine.h>
+
+#define BENCH_RUNS      (5)
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+uint32_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void bench_scrypt(bool huge_pages)
+{
+    scrypt_arena::set_huge_pages(huge_pages);
+
+    uint32_t phase1_total = 0;
+    uint32_t phase2_total = 0;
+    for(uint8_t run=0; run<BENCH_RUNS; run++)
+    {
+        scrypt<SCRYPT_N, SCRYPT_R, SCRYPT_P, MASTER_KEY_LEN> hasher;
+        uint32_t start = now_us();
+        uint32_t phase1_end = 0;
+        uint32_t phase2_end = 0;
+        hasher.hash( "password", "salt", [&] ( uint8_t percent ) {
+            if ( ( percent >= 5 ) && ( phase1_end == 0 ) )
+                phase1_end = now_us();
+            if ( percent < 100 )
+                phase2_end = now_us();
+        });
+        phase1_total += phase1_end - start;
+        phase2_total += phase2_end - phase1_end;
+    }
+
+    IO << ( huge_pages ? "Huge pages  " : "4K pages    " )
+       << "phase 1 " << phase1_total / BENCH_RUNS / 1000 << "ms, "
+       << "phase 2 " << phase2_total / BENCH_RUNS / 1000 << "ms" << endl;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void bench_recompute_cache(uint32_t entries)
+{
+    typedef scrypt_mixer<SCRYPT_N, SCRYPT_R, 1, MASTER_KEY_LEN, 0, 0> lane_mixer;
+
+    for(uint8_t cache=0; cache<2; cache++)
+    {
+        Salsa20Block block[SCRYPT_R*2];
+        memset( block, 0x5a, sizeof(block) );
+        lane_mixer mixer(0, 0, entries * SCRYPT_R * 2 * sizeof(Salsa20Block));
+        mixer.set_recompute_cache(cache != 0);
+        uint32_t start = now_us();
+        mixer.ROMix(block, 0);
+        uint32_t elapsed = now_us() - start;
+
+        const scrypt_mixer_stats& stats = mixer.get_stats();
+        IO << entries << " entries, sparse factor " << mixer.get_sparse_factor()
+           << ", " << stats.cache_slots << ( cache ? " cache slots in use, " : " cache slots unused, " )
+           << stats.hits << "/" << stats.lookups << " hits, "
+           << stats.replayed << " BlockMix replayed, " << elapsed / 1000 << "ms" << endl;
+    }
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void bench_batch(void)
+{
+    typedef scrypt_batch<SCRYPT_N, SCRYPT_R, SCRYPT_P, MASTER_KEY_LEN> batch_scrypt;
+    const char * passphrases[] = { "one", "two", "three", "four", "five", "six", "seven", "eight" };
+    const uint8_t * passphrase_ptrs[batch_scrypt::LANES];
+    const uint8_t * salt_ptrs[batch_scrypt::LANES];
+    uint32_t passphrase_sizes[batch_scrypt::LANES], salt_sizes[batch_scrypt::LANES];
+    for(uint8_t lane=0; lane<batch_scrypt::LANES; lane++)
+    {
+        passphrase_ptrs[lane] = reinterpret_cast<const uint8_t *>(passphrases[lane]);
+        passphrase_sizes[lane] = strlen(passphrases[lane]);
+        salt_ptrs[lane] = reinterpret_cast<const uint8_t *>("salt");
+        salt_sizes[lane] = 4;
+    }
+
+    // Both get resident V arrays, so it's the mixing being compared rather than page faults
+    batch_scrypt::prewarm();
+    batch_scrypt * batch = new batch_scrypt;
+    uint32_t batch_total = 0;
+    uint32_t single_total = 0;
+    for(uint8_t run=0; run<BENCH_RUNS; run++)
+    {
+        uint32_t start = now_us();
+        batch->hash(batch_scrypt::LANES, passphrase_ptrs, passphrase_sizes, salt_ptrs, salt_sizes, 0);
+        batch_total += now_us() - start;
+
+        start = now_us();
+        for(uint8_t lane=0; lane<batch_scrypt::LANES; lane++)
+        {
+            scrypt<SCRYPT_N, SCRYPT_R, SCRYPT_P, MASTER_KEY_LEN> single;
+            single.hash(passphrases[lane], "salt", 0);
+        }
+        single_total += now_us() - start;
+    }
+    delete batch;
+    scrypt_arena::release();
+
+    IO << (uint32_t)batch_scrypt::LANES << " keys one at a time " << single_total / BENCH_RUNS / 1000 << "ms, "
+       << "as a batch " << batch_total / BENCH_RUNS / 1000 << "ms" << endl;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void bench_engine(void)
+{
+    uint32_t engine_total = 0;
+    for(uint8_t run=0; run<BENCH_RUNS; run++)
+    {
+        scrypt_engine engine(SCRYPT_N, SCRYPT_R, SCRYPT_P, MASTER_KEY_LEN);
+        uint32_t start = now_us();
+        engine.hash("password", "salt");
+        engine_total += now_us() - start;
+    }
+    IO << "Runtime parameters " << engine_total / BENCH_RUNS / 1000 << "ms" << endl;
+
+    // Largest N for a few latency targets, r and p as recommended for interactive logins
+    const uint32_t targets[] = { 100, 250, 1000 };
+    for(uint8_t i=0; i<sizeof(targets)/sizeof(targets[0]); i++)
+    {
+        scrypt_calibration calibration = scrypt_engine::calibrate(targets[i]);
+        IO << "Within " << targets[i] << "ms: N=" << calibration.N << " r=" << calibration.r << " p=" << calibration.p
+           << " (" << calibration.elapsed_ms << "ms, " << (uint32_t)( calibration.memory / 1024 ) << "KB)" << endl;
+    }
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+int main()
+{
+    IO << "### Embedded Master Password scrypt benchmark ###" << endl;
+    IO << "scrypt N=" << SCRYPT_N << " r=" << SCRYPT_R << " p=" << SCRYPT_P << ", average of " << BENCH_RUNS << " runs" << endl;
+
+    // Once each to get everything going before timing anything
+    bench_scrypt(false);
+    bench_scrypt(true);
+    IO << endl;
+
+    bench_scrypt(false);
+    bench_scrypt(true);
+    IO << endl;
+
+    // Single lane ROMix with a sparse V, with and without the leftover entries as a cache
+    IO << "Sparse ROMix recompute cache" << endl;
+    bench_recompute_cache(8000);
+    bench_recompute_cache(5000);
+    bench_recompute_cache(1200);
+    IO << endl;
+
+    IO << "Multi-buffer batch" << endl;
+    bench_batch();
+    IO << endl;
+
+    IO << "Runtime scrypt engine" << endl;
+    bench_engine();
+    return 0;
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -31,17 +31,31 @@
 #include <io.h>
 #include <str_ptr.h>
 #include <sha256.h>
+#include <sha256x8.h>
 #include <hmac.h>
+#include <hmacx8.h>
 #include <pbkdf2.h>
 #include <scrypt.h>
+#include <scrypt-batch.h>
+#include <scrypt-engine.h>
+#include <salsa20x8.h>
 #include <mpw.h>
+#include <mpw-batch.h>
 #include "../src/version.h"
+#ifdef __linux__
+#include <sys/resource.h>
+#include <unistd.h>
+#include <glob.h>
+#include <thread>
+#endif
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 // Foward declarations of test functions
 void test_str_ptr(void);
 void test_sha256(void);
+void test_sha256x8(void);
 void test_hmac_sha256(void);
+void test_hmacx8_sha256(void);
 void test_pbkdf2_hmac_sha256(void);
 void test_scrypt(void);
 void test_MPW(void);
@@ -55,8 +69,12 @@ int main()
     test_str_ptr();
     IO << "SHA256 tests **********************************************" << endl;
     test_sha256();
+    IO << "SHA256x8 tests ********************************************" << endl;
+    test_sha256x8();
     IO << "HMAC-SHA256 tests *****************************************" << endl;
     test_hmac_sha256();
+    IO << "HMACx8-SHA256 tests ***************************************" << endl;
+    test_hmacx8_sha256();
     IO << "PBKDF2-HMAC-SHA256 tests **********************************" << endl;
     test_pbkdf2_hmac_sha256();    
     IO << "scrypt tests **********************************************" << endl;
@@ -105,7 +123,7 @@ uint8_t H2I(const char c)
 	return 10 + c - 'a';
 }
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-void assert_hash(const uint8_t *hash, const char *expected, const char *test, uint8_t hash_len)
+void assert_hash(const uint8_t *hash, const char *expected, const char *test, uint16_t hash_len)
 {
 	assert( strlen(expected), (size_t)(hash_len*2), "Length of `expected` string is incorrect");
 	for(int i=0;i<hash_len;i++)
@@ -187,6 +205,115 @@ void test_sha256(void)
     for(int i=0;i<1000000;i++)
         sha256.enqueue('a');
     assert_hash( sha256.digest(), "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0", "FIPS 180-2 B.3", SHA256::HASH_SIZE_BYTES);
+    // Same again, but fed in odd sized pieces so the bulk enqueue has to deal with unaligned heads and tails
+    uint8_t a_buffer[1000];
+    memset(a_buffer, 'a', sizeof(a_buffer));
+    sha256.reset();
+    for(uint32_t remaining=1000000, piece=1; remaining > 0; piece = ( piece * 7 + 3 ) % sizeof(a_buffer) + 1 )
+    {
+        uint32_t use = piece < remaining ? piece : remaining;
+        sha256.enqueue(a_buffer, use);
+        remaining -= use;
+    }
+    assert_hash( sha256.digest(), "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0", "FIPS 180-2 B.3 (bulk)", SHA256::HASH_SIZE_BYTES);
+
+#ifdef EMPW_X86
+    // The vectors above went through whichever compression the CPU picked, so cross check
+    // the hardware one against the portable one on a pile of pseudo-random chunks
+    if ( cpu_has_sha_ni() )
+    {
+        uint32_t seed = 0x12345678;
+        uint32_t portable_hash[8], hardware_hash[8], message[SHA256_MESSAGE_SCHEDULE_SIZE];
+        for(int chunk=0; chunk<1000; chunk++)
+        {
+            for(int i=0;i<8;i++)
+                portable_hash[i] = hardware_hash[i] = seed = seed * 1103515245 + 12345;
+            for(int i=0;i<16;i++)
+                message[i] = seed = seed * 1103515245 + 12345;
+            sha256_shani_hash_chunk(hardware_hash, message, SHA256::round_constants());
+            SHA256::hash_chunk_portable(portable_hash, message);
+            assert( memcmp(portable_hash, hardware_hash, sizeof(portable_hash)) == 0, true, "SHA-NI chunk matches portable chunk");
+        }
+        IO << "Test [SHA-NI matches portable compression] passed" << endl;
+    }
+#endif
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//
+//      SHA256x8 suite
+//
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Lane messages of assorted lengths, chosen so the lanes need different numbers of chunks and
+// hit the padding edge cases (55/56/63/64 bytes)
+const char * multi_buffer_messages[SHA256X8_LANES] = {
+    "",
+    "abc",
+    "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+    "The quick brown fox jumps over the lazy dog",
+    "0123456789012345678901234567890123456789012345678901234",
+    "012345678901234567890123456789012345678901234567890123456789012",
+    "0123456789012345678901234567890123456789012345678901234567890123",
+    "This is a test using a larger than block-size key and a larger than block-size data. The key needs to be hashed before being used by the HMAC algorithm.",
+};
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void test_sha256x8(void)
+{
+    const uint8_t * messages[SHA256X8_LANES];
+    uint32_t        sizes[SHA256X8_LANES];
+    for(uint8_t i=0; i<SHA256X8_LANES; i++)
+    {
+        messages[i] = reinterpret_cast<const uint8_t *>(multi_buffer_messages[i]);
+        sizes[i] = strlen(multi_buffer_messages[i]);
+    }
+
+    SHA256x8 sha256x8;
+    sha256x8.hash(SHA256X8_LANES, messages, sizes);
+    assert_hash( sha256x8.digest(0), "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855", "Lane 0 empty string", SHA256::HASH_SIZE_BYTES );
+    assert_hash( sha256x8.digest(1), "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad", "Lane 1 FIPS 180-2 B.1", SHA256::HASH_SIZE_BYTES );
+    assert_hash( sha256x8.digest(2), "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1", "Lane 2 FIPS 180-2 B.2", SHA256::HASH_SIZE_BYTES );
+    for(uint8_t i=3; i<SHA256X8_LANES; i++)
+    {
+        SHA256 sha256(multi_buffer_messages[i]);
+        char ctx_buf[40];
+        sprintf(ctx_buf, "Lane %d matches SHA256", i);
+        assert( memcmp( sha256x8.digest(i), sha256.digest(), SHA256::HASH_SIZE_BYTES ) == 0, true, ctx_buf );
+    }
+    IO << "Test [Lanes 3..7 match SHA256] passed" << endl;
+
+    // Partial batches leave the unused lanes alone
+    sha256x8.hash(2, &messages[1], &sizes[1]);
+    assert_hash( sha256x8.digest(0), "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad", "Partial batch lane 0", SHA256::HASH_SIZE_BYTES );
+    assert_hash( sha256x8.digest(1), "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1", "Partial batch lane 1", SHA256::HASH_SIZE_BYTES );
+
+    // All the kernels must agree with each other
+    uint32_t seed = 0x87654321;
+    uint32_t portable_state[SHA256::STATE_SIZE_WORDS][SHA256X8_LANES], schedule[SHA256_MESSAGE_SCHEDULE_SIZE][SHA256X8_LANES];
+    for(uint8_t i=0; i<SHA256::STATE_SIZE_WORDS; i++)
+        for(uint8_t j=0; j<SHA256X8_LANES; j++)
+            portable_state[i][j] = seed = seed * 1103515245 + 12345;
+    for(uint8_t i=0; i<16; i++)
+        for(uint8_t j=0; j<SHA256X8_LANES; j++)
+            schedule[i][j] = seed = seed * 1103515245 + 12345;
+#ifdef EMPW_X86
+    uint32_t sse2_state[SHA256::STATE_SIZE_WORDS][SHA256X8_LANES];
+    memcpy( sse2_state, portable_state, sizeof(sse2_state));
+    SHA256x8::hash_chunks_sse2(sse2_state, schedule, 0);
+    SHA256x8::hash_chunks_sse2(sse2_state, schedule, 4);
+    if ( cpu_has_avx2() )
+    {
+        uint32_t avx2_state[SHA256::STATE_SIZE_WORDS][SHA256X8_LANES];
+        memcpy( avx2_state, portable_state, sizeof(avx2_state));
+        SHA256x8::hash_chunks_avx2(avx2_state, schedule);
+        assert( memcmp( avx2_state, sse2_state, sizeof(avx2_state) ) == 0, true, "AVX2 kernel matches SSE2 kernel" );
+    }
+#endif
+    SHA256x8::hash_chunks_portable(portable_state, schedule);
+#ifdef EMPW_X86
+    assert( memcmp( portable_state, sse2_state, sizeof(portable_state) ) == 0, true, "SSE2 kernel matches portable kernel" );
+#endif
+    IO << "Test [Multi-buffer kernels agree] passed" << endl;
 }
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 //
@@ -222,6 +349,59 @@ void test_hmac_sha256(void)
     assert_hmac_sha256("\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa", "Test Using Larger Than Block-Size Key - Hash Key First", "60e431591ee0b67f0d8a26aacbf5b77f8e0bc6213728c5140546040f0ee37f54", "RFC 4231 - Test Case #6");
     // From https://tools.ietf.org/html/rfc4231#section-4.8
     assert_hmac_sha256("\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa\x0aa", "This is a test using a larger than block-size key and a larger than block-size data. The key needs to be hashed before being used by the HMAC algorithm.", "9b09ffa71b942fcb27635fbcd5b0e944bfdc63644f0713938a7f51535c3a35e2", "RFC 4231 - Test Case #7");    
+    // A prepared key can be reused for several messages, both by cloning and by resetting
+    HMAC_key<SHA256> jefe(reinterpret_cast<const uint8_t *>("Jefe"), 4);
+    HMAC<SHA256> cloned(jefe, reinterpret_cast<const uint8_t *>("what do ya want for nothing?"), 28);
+    assert_hash( cloned.digest(), "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843", "RFC 4231 - Test Case #2 from prepared key", SHA256::HASH_SIZE_BYTES );
+    cloned.reset();
+    cloned.enqueue(reinterpret_cast<const uint8_t *>("what do ya want for nothing?"), 28);
+    assert_hash( cloned.digest(), "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843", "RFC 4231 - Test Case #2 after reset", SHA256::HASH_SIZE_BYTES );
+    HMAC<SHA256> another(cloned.get_key(), reinterpret_cast<const uint8_t *>("what do ya want for nothing?"), 28);
+    assert_hash( another.digest(), "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843", "RFC 4231 - Test Case #2 from copied key", SHA256::HASH_SIZE_BYTES );
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//
+//      HMACx8_SHA256 suite
+//
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void test_hmacx8_sha256(void)
+{
+    const uint8_t * messages[SHA256X8_LANES];
+    uint32_t        sizes[SHA256X8_LANES];
+    for(uint8_t i=0; i<SHA256X8_LANES; i++)
+    {
+        messages[i] = reinterpret_cast<const uint8_t *>(multi_buffer_messages[i]);
+        sizes[i] = strlen(multi_buffer_messages[i]);
+    }
+
+    // Short key
+    HMACx8 hmacx8("key");
+    hmacx8.hash(SHA256X8_LANES, messages, sizes);
+    // From https://en.wikipedia.org/wiki/HMAC#Examples
+    assert_hash( hmacx8.digest(3), "f7bc83f430538424b13298e6aa6fb143ef4d59a14946175997479dbc2d1a3cd8", "Wikipedia example in lane 3", SHA256::HASH_SIZE_BYTES );
+    for(uint8_t i=0; i<SHA256X8_LANES; i++)
+    {
+        HMAC<SHA256> hmac("key", multi_buffer_messages[i]);
+        char ctx_buf[40];
+        sprintf(ctx_buf, "Lane %d matches HMAC", i);
+        assert( memcmp( hmacx8.digest(i), hmac.digest(), SHA256::HASH_SIZE_BYTES ) == 0, true, ctx_buf );
+    }
+    IO << "Test [All lanes match HMAC with short key] passed" << endl;
+
+    // Longer than block size key gets hashed first
+    const char * long_key = "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef";
+    HMACx8 long_hmacx8(long_key);
+    long_hmacx8.hash(SHA256X8_LANES, messages, sizes);
+    for(uint8_t i=0; i<SHA256X8_LANES; i++)
+    {
+        HMAC<SHA256> hmac(long_key, multi_buffer_messages[i]);
+        char ctx_buf[40];
+        sprintf(ctx_buf, "Lane %d matches HMAC", i);
+        assert( memcmp( long_hmacx8.digest(i), hmac.digest(), SHA256::HASH_SIZE_BYTES ) == 0, true, ctx_buf );
+    }
+    IO << "Test [All lanes match HMAC with long key] passed" << endl;
 }
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 //
@@ -245,6 +425,10 @@ void test_pbkdf2_hmac_sha256(void)
     assert_pkbdf2_hmac_sha256<32>("password", "salt", 4096, "c5e478d59288c841aa530db6845c4c8d962893a001ce4e11a4963873aa98134a", "Unknown #3");
     // Unknown#4 ignored as it has 2^32 iterations and I'm not about to wait for that ;-)
     assert_pkbdf2_hmac_sha256<40>("passwordPASSWORDpassword", "saltSALTsaltSALTsaltSALTsaltSALTsalt", 4096, "348c89dbcbd32b2f32d814b8116e84cf2b17347ebc1800181c4e2a1fb8dd53e1c635518c7dac47e9", "Unknown #5");
+    // Salt longer than a chunk, several output blocks picking up from the salted state (generated with Python hashlib.pbkdf2_hmac)
+    assert_pkbdf2_hmac_sha256<80>("password", "saltSALTsaltSALTsaltSALTsaltSALTsaltSALTsaltSALTsaltSALTsaltSALTsaltSALTsaltSALTsaltSALTsaltSALT", 3, "8764b015052d5883129194fee2c6a689b8dceb0e13da001a2e9834a929c3c3114711dcd9ea08010473e519a0dee0b97eb91dcaa8508cd3bd8a9af139c8f73b54453813833d32187ca25fdc99ce21cf3b", "Long salt, 3 blocks" );
+    // More blocks than the multi-buffer lanes plus a partial one, so the wide and the one at a time paths both get used
+    assert_pkbdf2_hmac_sha256<332>("password", "saltSALTsaltSALTsaltSALTsaltSALTsaltSALTsaltSALTsaltSALTsaltSALTsaltSALTsaltSALTsaltSALTsaltSALT", 3, "8764b015052d5883129194fee2c6a689b8dceb0e13da001a2e9834a929c3c3114711dcd9ea08010473e519a0dee0b97eb91dcaa8508cd3bd8a9af139c8f73b54453813833d32187ca25fdc99ce21cf3b782fbc1df00ba1c8194fe2d692e40c86839610c8689ea8b2c134ed197e03c12c8b6e1745d11ec980023e683dfff1306b6d70f5b3662473ce20f722c450efcedac37feb0618ae3a3dbd58281b9b68e0d204ff22adf2901233363222deda8555dfe75bb00ec2bbafeba6c24441e4c49198fda71eb5165e355c136a4d23b01b1b4ce2698ad4224754853f05fd045ec3556bcc94cede591ac4a630401b3307b277ec10a154d1d05aaaf4b6624e063767b26c857f7d30282bb95e788473aae9f8e9df85c8be6b0ac200e04add67e5fa9d61e3e413b5b5337ca948095d0e04ea76f7567d8a06a66837d901d88341690c29ea2b6b8efcddf5cfc18679c68873", "Long salt, 11 blocks" );
     // https://tools.ietf.org/html/rfc7914#page-12 #1
     assert_pkbdf2_hmac_sha256<64>("passwd", "salt", 1, "55ac046e56e3089fec1691c22544b605f94185216dde0465e68b9d57c20dacbc49ca9cccf179b645991664b39d77ef317c71b845b1e30bd509112041d3a19783", "RFC7914 Test #1" );
     // https://tools.ietf.org/html/rfc7914#page-12 #2
@@ -275,6 +459,97 @@ void test_scrypt(void)
 		sprintf(&exp1_hex[i<<1],"%.02x",exp1[i]);
 	assert_hash(in1,exp1_hex, "Salsa20 Test vector #2", sizeof(in1));
 
+    // Off x86 the scrypt vectors go through the unrolled BlockMix, so check it (and its xor of a
+    // second input) against the plain one with r=8 like MPW
+    {
+        scrypt_mixer<16,8,1,64,0,0> mixer8;
+        Salsa20Block input[16], other[16], xored[16], plain[16], unrolled[16];
+        uint32_t seed = 0x2468ACE1;
+        for(int round=0; round<100; round++)
+        {
+            for(int block=0; block<16; block++)
+                for(int i=0; i<SALSA20_ENTRY_COUNT; i++)
+                {
+                    input[block].entry[i].as_word32 = seed = seed * 1103515245 + 12345;
+                    other[block].entry[i].as_word32 = seed = seed * 1103515245 + 12345;
+                }
+            mixer8.BlockMix(input, plain);
+            salsa20_unrolled_block_mix<8>(input, unrolled);
+            assert( memcmp(plain, unrolled, sizeof(plain)) == 0, true, "Unrolled BlockMix matches plain BlockMix");
+            for(int block=0; block<16; block++)
+                xored[block].Xor(input[block], other[block]);
+            mixer8.BlockMix(xored, plain);
+            salsa20_unrolled_block_mix<8>(input, unrolled, other);
+            assert( memcmp(plain, unrolled, sizeof(plain)) == 0, true, "Unrolled BlockMix with xor matches plain BlockMix");
+        }
+        IO << "Test [Unrolled BlockMix matches plain BlockMix] passed" << endl;
+    }
+
+    // Every lane of the multi-buffer BlockMix against the plain one, and where there's more
+    // than one way of doing it here, every way against each other
+    {
+        scrypt_mixer<16,8,1,64,0,0> mixer8;
+        Salsa20Block input[SALSA20X8_LANES][16], other[SALSA20X8_LANES][16], plain[SALSA20X8_LANES][16], output[SALSA20X8_LANES][16];
+        Salsa20Block * input_ptrs[SALSA20X8_LANES];
+        Salsa20Block * other_ptrs[SALSA20X8_LANES];
+        Salsa20Block * output_ptrs[SALSA20X8_LANES];
+        Salsa20BlockX8 x[16], xo[16], y[16], y_portable[16];
+        uint32_t seed = 0x0F1E2D3C;
+        for(uint8_t lane=0; lane<SALSA20X8_LANES; lane++)
+        {
+            for(int block=0; block<16; block++)
+                for(int i=0; i<SALSA20_ENTRY_COUNT; i++)
+                {
+                    input[lane][block].entry[i].as_word32 = seed = seed * 1103515245 + 12345;
+                    other[lane][block].entry[i].as_word32 = seed = seed * 1103515245 + 12345;
+                }
+            Salsa20Block xored[16];
+            for(int block=0; block<16; block++)
+                xored[block].Xor(input[lane][block], other[lane][block]);
+            mixer8.BlockMix(xored, plain[lane]);
+            input_ptrs[lane] = input[lane];
+            other_ptrs[lane] = other[lane];
+            output_ptrs[lane] = output[lane];
+        }
+
+        salsa20x8_set_lanes(x, input_ptrs, 16);
+        salsa20x8_set_lanes_portable(xo, other_ptrs, 16);
+        salsa20x8_block_mix(x, y, 8, xo);
+        salsa20x8_get_lanes(y, output_ptrs, 16);
+        assert( memcmp(plain, output, sizeof(plain)) == 0, true, "Salsa20x8 BlockMix matches plain BlockMix");
+        salsa20x8_block_mix_portable(x, y_portable, 8, xo);
+        assert( memcmp(y, y_portable, sizeof(y)) == 0, true, "Portable Salsa20x8 BlockMix matches");
+#ifdef EMPW_X86
+        salsa20x8_block_mix_sse2(x, y_portable, 8, xo);
+        assert( memcmp(y, y_portable, sizeof(y)) == 0, true, "SSE2 Salsa20x8 BlockMix matches");
+        salsa20x8_get_lanes_portable(y, output_ptrs, 16);
+        assert( memcmp(plain, output, sizeof(plain)) == 0, true, "Portable Salsa20x8 lanes match");
+#endif
+        IO << "Test [Salsa20x8 BlockMix] passed" << endl;
+    }
+
+#ifdef EMPW_X86
+    // The scrypt vectors below run ROMix through the SSE2 BlockMix, so also check it directly
+    // against the plain one (with r=8 like MPW) on some pseudo-random blocks
+    {
+        scrypt_mixer<16,8,1,64,0,0> mixer8;
+        Salsa20Block input[16], plain[16], shuffled[16], sse2[16];
+        uint32_t seed = 0x87654321;
+        for(int round=0; round<100; round++)
+        {
+            for(int block=0; block<16; block++)
+                for(int i=0; i<SALSA20_ENTRY_COUNT; i++)
+                    input[block].entry[i].as_word32 = seed = seed * 1103515245 + 12345;
+            mixer8.BlockMix(input, plain);
+            salsa20_sse2_shuffle(shuffled, input, 16);
+            salsa20_sse2_block_mix(shuffled, input, 8);
+            salsa20_sse2_unshuffle(sse2, input, 16);
+            assert( memcmp(plain, sse2, sizeof(plain)) == 0, true, "SSE2 BlockMix matches plain BlockMix");
+        }
+        IO << "Test [SSE2 BlockMix matches plain BlockMix] passed" << endl;
+    }
+#endif
+
 	scrypt<16,1,1,64> scrypt1;
 	const uint8_t * r = scrypt1.hash( "", "", 0 );
     assert_hash(r, "77d6576238657b203b19ca42c18a0497f16b4844e3074ae8dfdffa3fede21442fcd0069ded0948f8326a753a0fc81f17e8d3e0fb2e0d3628cf35e20c38d18906", "scrypt #1", 64 );
@@ -283,7 +558,391 @@ void test_scrypt(void)
     r = scrypt2.hash( "", "", 0 );
     assert_hash(r, "8d12c62f0dab079dcb95b698a5012d79cf25ae9f6a2e2990f797ea92bcb907a656f1d3c886b0f1c725e42adcc54713fb514d2e070ea3070a4cfcd6c877a364b8", "scrypt #2", 64 );
 
+    // Same again with the lanes run one after the other, whichever mode is the default
+    scrypt2.set_lane_mode( scrypt2.get_lane_mode() == SCRYPT_LANES_INTERLEAVED ? SCRYPT_LANES_SEQUENTIAL : SCRYPT_LANES_INTERLEAVED );
+    r = scrypt2.hash( "", "", 0 );
+    assert_hash(r, "8d12c62f0dab079dcb95b698a5012d79cf25ae9f6a2e2990f797ea92bcb907a656f1d3c886b0f1c725e42adcc54713fb514d2e070ea3070a4cfcd6c877a364b8", "scrypt #2 (other lane mode)", 64 );
+
+#ifndef ARDUINO
+    // And with a thread per lane, the progress has to arrive in order and finish at 100
+    {
+        uint8_t last_percent = 0;
+        bool in_order = true;
+        scrypt2.set_lane_mode( SCRYPT_LANES_THREADED );
+        r = scrypt2.hash( "", "", [&] ( uint8_t percent ) { in_order = in_order && ( percent >= last_percent ); last_percent = percent; } );
+        assert_hash(r, "8d12c62f0dab079dcb95b698a5012d79cf25ae9f6a2e2990f797ea92bcb907a656f1d3c886b0f1c725e42adcc54713fb514d2e070ea3070a4cfcd6c877a364b8", "scrypt #2 (threaded)", 64 );
+        assert( in_order, true, "Threaded progress is monotonic");
+        assert( last_percent, 100, "Threaded progress completes");
+    }
+#endif
+
+    // Sparse V with leftover entries for the recompute cache gives the same answer with or without it
+    {
+        typedef scrypt_mixer<64,1,1,64,0,0> cache_mixer;
+        Salsa20Block full_block[2], cached_block[2], uncached_block[2];
+        memset( full_block, 0x42, sizeof(full_block) );
+        memcpy( cached_block, full_block, sizeof(full_block) );
+        memcpy( uncached_block, full_block, sizeof(full_block) );
+        cache_mixer full(0, 0, 64*2*sizeof(Salsa20Block));
+        full.ROMix(full_block, 0);
+        cache_mixer cached(0, 0, 20*2*sizeof(Salsa20Block));
+        cached.ROMix(cached_block, 0);
+        cache_mixer uncached(0, 0, 20*2*sizeof(Salsa20Block));
+        uncached.set_recompute_cache(false);
+        uncached.ROMix(uncached_block, 0);
+        assert( (size_t)cached.get_stats().cache_slots, (size_t)4, "Recompute cache uses the leftover entries");
+        assert( memcmp(full_block, cached_block, sizeof(full_block)) == 0, true, "ROMix with recompute cache matches full V");
+        assert( memcmp(full_block, uncached_block, sizeof(full_block)) == 0, true, "ROMix without recompute cache matches full V");
+        assert( cached.get_stats().hits > 0, true, "Recompute cache gets hits");
+        assert( cached.get_stats().replayed < uncached.get_stats().replayed, true, "Recompute cache saves BlockMix");
+        IO << "Test [Sparse ROMix recompute cache] passed" << endl;
+    }
+
+    // A power of two sparse factor only when it doesn't cost more replays than the exact one
+    {
+        typedef scrypt_mixer<64,1,1,64,0,0> factor_mixer;
+        Salsa20Block full_block[2], exact_block[2];
+        memset( full_block, 0x5A, sizeof(full_block) );
+        memcpy( exact_block, full_block, sizeof(full_block) );
+        factor_mixer full(0, 0, 64*2*sizeof(Salsa20Block));
+        full.ROMix(full_block, 0);
+        factor_mixer pow2(0, 0, 20*2*sizeof(Salsa20Block));
+        assert( (size_t)pow2.get_sparse_factor(), (size_t)4, "Power of two sparse factor");
+        factor_mixer exact(0, 0, 24*2*sizeof(Salsa20Block));
+        assert( (size_t)exact.get_sparse_factor(), (size_t)3, "Exact sparse factor");
+        exact.ROMix(exact_block, 0);
+        assert( memcmp(full_block, exact_block, sizeof(full_block)) == 0, true, "ROMix with exact sparse factor matches full V");
+        IO << "Test [Sparse factor choice] passed" << endl;
+    }
+
+#ifndef ARDUINO
+    // A Teensy without PSRAM, the local tier in the global slot is as dense as it was on the stack
+    {
+        typedef scrypt_mixer<SCRYPT_N,SCRYPT_R,SCRYPT_P,MASTER_KEY_LEN,ROMIX_SPARSE_V_STACK_MAX,ROMIX_SPARSE_V_MALLOC_MAX> stack_mixer;
+        typedef scrypt_mixer<SCRYPT_N,SCRYPT_R,SCRYPT_P,MASTER_KEY_LEN,0,0> local_mixer;
+        stack_mixer* on_stack = new stack_mixer(0, 0, ROMIX_SPARSE_V_MALLOC_MAX);
+        Salsa20Block* local_tier = (Salsa20Block*)malloc(ROMIX_SPARSE_V_STACK_MAX);
+        local_mixer* stepped = new local_mixer(local_tier, ROMIX_SPARSE_V_STACK_MAX, ROMIX_SPARSE_V_MALLOC_MAX);
+        assert( (size_t)stepped->get_sparse_factor(), (size_t)on_stack->get_sparse_factor(), "Local tier sparse factor matches the stack tier");
+        local_mixer* heap_only = new local_mixer(0, 0, ROMIX_SPARSE_V_MALLOC_MAX);
+        assert( heap_only->get_sparse_factor() > stepped->get_sparse_factor(), true, "Local tier makes V denser");
+        delete heap_only;
+        delete stepped;
+        free(local_tier);
+        delete on_stack;
+        IO << "Test [Teensy local tier] passed" << endl;
+    }
+#endif
+
+    // Squeezed into a memory budget, which makes V sparse, same answer just slower
+    {
+        typedef scrypt_mixer<16,8,2,64,0,0> budget_mixer;
+        assert( (size_t)budget_mixer::heap_for_budget(4096), (size_t)4096, "Budget of 4 entries");
+        assert( (size_t)budget_mixer::heap_for_budget(4095), (size_t)3072, "Budget rounds down to whole entries");
+        assert( (size_t)budget_mixer::heap_for_budget(1), (size_t)1024, "Budget never below one entry");
+        assert( (size_t)budget_mixer::heap_for_budget(1024*1024), (size_t)16384, "Budget never above full V");
+        budget_mixer sparse(0, 0, budget_mixer::heap_for_budget(4096));
+        assert( (size_t)sparse.get_sparse_factor(), (size_t)4, "Sparse factor for budget");
+
+        scrypt_options options;
+        options.memory_budget = 8192;
+        scrypt2.set_options(options);
+        r = scrypt2.hash( "", "", 0 );
+        assert_hash(r, "8d12c62f0dab079dcb95b698a5012d79cf25ae9f6a2e2990f797ea92bcb907a656f1d3c886b0f1c725e42adcc54713fb514d2e070ea3070a4cfcd6c877a364b8", "scrypt #2 (8KB budget)", 64 );
+    }
+
+#ifdef __linux__
+    // Some or all of V in a memory mapped file, for each of memfd, temporary file and named file
+    {
+        char named[64];
+        snprintf( named, sizeof(named), "/tmp/empw-test-v-%d", (int)getpid() );
+        const char * files[] = { NULL, "/tmp", named };
+        // Something of the user's already at the named path
+        const char * existing = "not a V array";
+        FILE * f = fopen( named, "wb" );
+        if ( f != NULL )
+        {
+            fputs( existing, f );
+            fclose( f );
+        }
+        scrypt_options options;
+        for(uint8_t i=0; i<countof(files); i++)
+        {
+            options.global_file = files[i];
+            options.lane_mode = ( i & 1 ) ? SCRYPT_LANES_THREADED : SCRYPT_LANES_INTERLEAVED;
+            options.memory_budget = 0;
+            options.global_size = 32768;
+            scrypt2.set_options(options);
+            r = scrypt2.hash( "", "", 0 );
+            assert_hash(r, "8d12c62f0dab079dcb95b698a5012d79cf25ae9f6a2e2990f797ea92bcb907a656f1d3c886b0f1c725e42adcc54713fb514d2e070ea3070a4cfcd6c877a364b8", "scrypt #2 (global tier only)", 64 );
+            options.memory_budget = 8192;
+            options.global_size = 8192;
+            scrypt2.set_options(options);
+            r = scrypt2.hash( "", "", 0 );
+            assert_hash(r, "8d12c62f0dab079dcb95b698a5012d79cf25ae9f6a2e2990f797ea92bcb907a656f1d3c886b0f1c725e42adcc54713fb514d2e070ea3070a4cfcd6c877a364b8", "scrypt #2 (heap and global tier)", 64 );
+        }
+
+        // Two hashes at once on the same named path each get a V of their own
+        {
+            typedef scrypt<4096,8,2,64> racing_scrypt;
+            uint8_t first_expected[64], second_expected[64];
+            racing_scrypt reference;
+            memcpy( first_expected, reference.hash( "first", "salt", 0 ), 64 );
+            memcpy( second_expected, reference.hash( "second", "salt", 0 ), 64 );
+
+            options.memory_budget = 0;
+            options.global_size = 4096*8*128;
+            options.lane_mode = SCRYPT_LANES_SEQUENTIAL;
+            racing_scrypt first, second;
+            first.set_options(options);
+            second.set_options(options);
+            const uint8_t * first_result = 0;
+            const uint8_t * second_result = 0;
+            std::thread other( [&] () { second_result = second.hash( "second", "salt", 0 ); } );
+            first_result = first.hash( "first", "salt", 0 );
+            other.join();
+            assert( ( first_result != 0 ) && ( memcmp( first_result, first_expected, 64 ) == 0 ), true, "Concurrent hash on a named global tier");
+            assert( ( second_result != 0 ) && ( memcmp( second_result, second_expected, 64 ) == 0 ), true, "Other concurrent hash on a named global tier");
+        }
+
+        // What was at the named path is untouched and none of the private files are left
+        char contents[64];
+        f = fopen( named, "rb" );
+        size_t got = ( f != NULL ) ? fread( contents, 1, sizeof(contents), f ) : 0;
+        if ( f != NULL )
+            fclose( f );
+        remove( named );
+        assert( ( got == strlen(existing) ) && ( memcmp( contents, existing, got ) == 0 ), true, "Existing file at the global tier path untouched" );
+        char pattern[72];
+        snprintf( pattern, sizeof(pattern), "%s.*", named );
+        glob_t leftovers;
+        int found = glob( pattern, 0, NULL, &leftovers );
+        if ( found == 0 )
+            globfree( &leftovers );
+        assert( found == GLOB_NOMATCH, true, "Global tier files removed" );
+
+        // A file that can't be made falls back on the heap, quietly if asked to
+        options.global_file = "/nonexistent/empw-test-v";
+        options.quiet = true;
+        scrypt2.set_options(options);
+        r = scrypt2.hash( "", "", 0 );
+        assert_hash(r, "8d12c62f0dab079dcb95b698a5012d79cf25ae9f6a2e2990f797ea92bcb907a656f1d3c886b0f1c725e42adcc54713fb514d2e070ea3070a4cfcd6c877a364b8", "scrypt #2 (global tier unmapped)", 64 );
+        assert( scrypt2.get_warnings(), (uint8_t)SCRYPT_WARN_GLOBAL_MAP, "Unmapped global tier is a warning");
+        scrypt2.set_options(scrypt_options());
+        IO << "Test [scrypt global tier file] passed" << endl;
+    }
+#endif
+
+#ifdef __linux__
+    // Not enough address space for the whole V, so the mixer backs off to a sparser one
+    {
+        typedef scrypt_mixer<16384,8,1,64,0,0> squeezed_mixer;
+        const uint32_t full_size = 16384*8*2*sizeof(Salsa20Block);
+        Salsa20Block full_block[16], squeezed_block[16];
+        memset( full_block, 0xA5, sizeof(full_block) );
+        memcpy( squeezed_block, full_block, sizeof(full_block) );
+        {
+            squeezed_mixer full(0, 0, full_size);
+            full.ROMix(full_block, 0);
+        }
+
+        long pages = 0;
+        FILE * statm = fopen("/proc/self/statm", "r");
+        if ( statm != NULL )
+        {
+            if ( fscanf(statm, "%ld", &pages) != 1 )
+                pages = 0;
+            fclose(statm);
+        }
+        struct rlimit limit, squeezed;
+        getrlimit(RLIMIT_AS, &limit);
+        squeezed = limit;
+        squeezed.rlim_cur = pages * sysconf(_SC_PAGESIZE) + full_size / 2;
+        setrlimit(RLIMIT_AS, &squeezed);
+        squeezed_mixer mixer(0, 0, full_size);
+        setrlimit(RLIMIT_AS, &limit);
+
+        assert( mixer.get_heap_size() < full_size, true, "Heap V backs off when it can't have it all");
+        assert( mixer.get_sparse_factor() > 1, true, "Backed off heap V is sparse");
+        mixer.ROMix(squeezed_block, 0);
+        assert( memcmp(full_block, squeezed_block, sizeof(full_block)) == 0, true, "Backed off ROMix matches full V");
+        IO << "Test [ROMix heap fallback] passed" << endl;
+    }
+#endif
+
+    // Odd number of lanes, so interleaving leaves one on its own (generated with Python hashlib.scrypt)
+	scrypt<64,8,3,64> scrypt_odd;
+    scrypt_odd.set_lane_mode( SCRYPT_LANES_INTERLEAVED );
+    r = scrypt_odd.hash( "password", "NaCl", 0 );
+    assert_hash(r, "d065f18460203b9eada7bf72eb1abaad6cb9cd9de3010fb81c66ede811dc45beef6914b2f0c3eb04de1df6f25e88d797020eefbb78d04c9ec6f2b8e24dee6cf2", "scrypt p=3 interleaved", 64 );
+
+    // Several calculations at once through the multi-buffer engine, one of them the RFC vector,
+    // a partly filled batch and a full one
+    {
+        const char * passphrases[] = { "password", "", "pleaseletmein", "a", "bb", "ccc", "dddd", "eeeee" };
+        const char * salts[] = { "NaCl", "", "SodiumChloride", "s", "ss", "sss", "ssss", "sssss" };
+        const uint8_t * passphrase_ptrs[SALSA20X8_LANES];
+        const uint8_t * salt_ptrs[SALSA20X8_LANES];
+        uint32_t passphrase_sizes[SALSA20X8_LANES], salt_sizes[SALSA20X8_LANES];
+        for(uint8_t lane=0; lane<SALSA20X8_LANES; lane++)
+        {
+            passphrase_ptrs[lane] = reinterpret_cast<const uint8_t *>(passphrases[lane]);
+            passphrase_sizes[lane] = strlen(passphrases[lane]);
+            salt_ptrs[lane] = reinterpret_cast<const uint8_t *>(salts[lane]);
+            salt_sizes[lane] = strlen(salts[lane]);
+        }
+
+        scrypt_batch<1024,8,16,64> batch;
+        assert( batch.hash(3, passphrase_ptrs, passphrase_sizes, salt_ptrs, salt_sizes, 0), true, "Batch of 3 hashed");
+        assert_hash(batch.key(0), "fdbabe1c9d3472007856e7190d01e9fe7c6ad7cbc8237830e77376634b3731622eaf30d92e22a3886ff109279d9830dac727afb94a83ee6d8360cbdfa2cc0640", "scrypt batch RFC vector", 64 );
+        for(uint8_t lane=1; lane<3; lane++)
+        {
+            scrypt<1024,8,16,64> single;
+            assert( memcmp(batch.key(lane), single.hash(passphrases[lane], salts[lane], 0), 64) == 0, true, "Batch lane matches scrypt");
+        }
+
+        scrypt_batch<64,8,3,64> full_batch;
+        assert( full_batch.hash(SALSA20X8_LANES, passphrase_ptrs, passphrase_sizes, salt_ptrs, salt_sizes, 0), true, "Full batch hashed");
+        bool all_match = true;
+        for(uint8_t lane=0; lane<SALSA20X8_LANES; lane++)
+        {
+            scrypt<64,8,3,64> single;
+            all_match = all_match && ( memcmp(full_batch.key(lane), single.hash(passphrases[lane], salts[lane], 0), 64) == 0 );
+        }
+        assert( all_match, true, "Full batch matches scrypt");
+        IO << "Test [scrypt batch] passed" << endl;
+    }
+
+    // Stepped scrypt, in small slices and with a full and a sparse V, comes out the same as hash
+    {
+        const uint32_t budgets[] = { 0, 64*1024 };
+        for(unsigned int b=0; b<countof(budgets); b++)
+        {
+            scrypt_options options;
+            options.memory_budget = budgets[b];
+            scrypt<1024,8,16,64> stepped;
+            stepped.set_options(options);
+            uint8_t last_percent = 0;
+            bool in_order = true;
+            stepped.begin(reinterpret_cast<const uint8_t*>("password"), 8, reinterpret_cast<const uint8_t*>("NaCl"), 4,
+                [&] ( uint8_t percent ) { in_order = in_order && ( percent >= last_percent ); last_percent = percent; } );
+            assert( stepped.done() || ( stepped.result() != NULL ), false, "Stepped scrypt not done after begin");
+            uint32_t steps = 1;
+            while ( !stepped.step(97) )
+                steps++;
+            assert( stepped.done() && in_order && ( last_percent == 100 ), true, "Stepped scrypt finished");
+            assert( steps >= 1024*2*16/(97+2), true, "Stepped scrypt kept to its slices");
+            assert_hash(stepped.result(), "fdbabe1c9d3472007856e7190d01e9fe7c6ad7cbc8237830e77376634b3731622eaf30d92e22a3886ff109279d9830dac727afb94a83ee6d8360cbdfa2cc0640", "Stepped scrypt RFC vector", 64 );
+        }
+        IO << "Test [Stepped scrypt] passed" << endl;
+    }
+
+    // Progress only for whole percent changes, nothing at all through the quiet policy, and a
+    // cancel part way leaves no result and nothing of V behind
+    {
+        const uint8_t * passphrase = reinterpret_cast<const uint8_t*>("password");
+        const uint8_t * salt = reinterpret_cast<const uint8_t*>("NaCl");
+        scrypt<1024,8,16,64> quiet;
+        scrypt_quiet_policy nothing;
+        assert_hash(quiet.hash(passphrase, 8, salt, 4, nothing), "fdbabe1c9d3472007856e7190d01e9fe7c6ad7cbc8237830e77376634b3731622eaf30d92e22a3886ff109279d9830dac727afb94a83ee6d8360cbdfa2cc0640", "scrypt quiet policy", 64 );
+
+        uint32_t calls = 0;
+        uint8_t last_percent = 0;
+        bool in_order = true;
+        scrypt<1024,8,16,64> throttled;
+        throttled.hash(passphrase, 8, salt, 4, [&] ( uint8_t percent ) { calls++; in_order = in_order && ( ( calls == 1 ) || ( percent > last_percent ) ); last_percent = percent; } );
+        assert( in_order && ( calls <= 101 ) && ( last_percent == 100 ), true, "scrypt progress once per percent");
+
+        scrypt_cancel_token cancel;
+        scrypt<1024,8,16,64> cancelled;
+        const uint8_t * r = cancelled.hash(passphrase, 8, salt, 4, [&] ( uint8_t percent ) { if ( percent >= 30 ) cancel.cancel(); }, &cancel );
+        assert( ( r == NULL ) && !cancelled.done(), true, "Cancelled scrypt has no result");
+        cancel.reset();
+        assert_hash(cancelled.hash(passphrase, 8, salt, 4, 0, &cancel), "fdbabe1c9d3472007856e7190d01e9fe7c6ad7cbc8237830e77376634b3731622eaf30d92e22a3886ff109279d9830dac727afb94a83ee6d8360cbdfa2cc0640", "scrypt after a cancel", 64 );
+
+        typedef scrypt_mixer<64,1,1,64,0,0> cancel_mixer;
+        Salsa20Block block[2];
+        memset( block, 0x42, sizeof(block) );
+        cancel_mixer mixer(0, 0, 64*2*sizeof(Salsa20Block));
+        scrypt_callback_policy<2> policy([&] ( uint8_t percent ) { if ( percent >= 30 ) cancel.cancel(); }, &cancel);
+        assert( mixer.ROMix(block, policy), false, "Cancelled ROMix stops");
+        bool wiped = true;
+        for(uint32_t i=0; i<64; i++)
+            for(uint8_t k=0; k<2*SALSA20_ENTRY_COUNT; k++)
+                wiped = wiped && ( mixer.get_entry_ptr(i)[k/SALSA20_ENTRY_COUNT].entry[k%SALSA20_ENTRY_COUNT].as_word32 == 0 );
+        assert( wiped, true, "Cancelled ROMix wipes V");
+        IO << "Test [scrypt progress and cancel] passed" << endl;
+    }
+
+    // Parameters at runtime through the one compiled engine, against the RFC 7914 vectors
+    {
+        scrypt_engine small(16, 1, 1, 64);
+        assert_hash(small.hash("", ""), "77d6576238657b203b19ca42c18a0497f16b4844e3074ae8dfdffa3fede21442fcd0069ded0948f8326a753a0fc81f17e8d3e0fb2e0d3628cf35e20c38d18906", "scrypt engine #1", 64 );
+        scrypt_engine lanes(1024, 8, 16, 64);
+        assert_hash(lanes.hash("password", "NaCl"), "fdbabe1c9d3472007856e7190d01e9fe7c6ad7cbc8237830e77376634b3731622eaf30d92e22a3886ff109279d9830dac727afb94a83ee6d8360cbdfa2cc0640", "scrypt engine #2", 64 );
+#ifndef ARDUINO
+        uint8_t last_percent = 0;
+        bool in_order = true;
+        scrypt_engine large(16384, 8, 1, 64);
+        assert_hash(large.hash("pleaseletmein", "SodiumChloride", [&] ( uint8_t percent ) { in_order = in_order && ( percent >= last_percent ); last_percent = percent; } ),
+            "7023bdcb3afd7348461c06cd81fd38ebfda8fbba904f8e3ea9b543f6545da1f2d5432955613f0fcf62d49705242a9af9e61e85dc0d651e40dfcf017b45575887", "scrypt engine #3", 64 );
+        assert( in_order && ( last_percent == 100 ), true, "scrypt engine progress");
+#endif
+
+        // A key length that isn't a whole number of SHA256 blocks, against the template
+        scrypt<64,2,3,37> fixed;
+        scrypt_engine odd(64, 2, 3, 37);
+        assert( memcmp(odd.hash("password", "NaCl"), fixed.hash("password", "NaCl", 0), 37) == 0, true, "scrypt engine matches scrypt");
+
+        scrypt_engine not_power_of_2(1000, 8, 1, 64);
+        assert( not_power_of_2.hash("password", "NaCl") == NULL, true, "scrypt engine refuses bad N");
+        scrypt_cancel_token cancel;
+        cancel.cancel();
+        assert( lanes.hash(reinterpret_cast<const uint8_t*>("password"), 8, reinterpret_cast<const uint8_t*>("NaCl"), 4, 0, &cancel) == NULL, true, "Cancelled scrypt engine has no result");
+
+        scrypt_calibration calibration = scrypt_engine::calibrate(1000, 1024*1024);
+        assert( ( calibration.N >= SCRYPT_CALIBRATE_MIN_N ) && ( calibration.memory <= 1024*1024 ) && ( calibration.elapsed_ms <= 1000 ), true, "scrypt calibration within budget");
+        IO << "Test [scrypt engine] passed" << endl;
+    }
+
+    // Interleaved lanes with a sparse V (4 of 16 entries) against the full V done one lane at a time
+    {
+        Salsa20Block sparse_blocks[32], full_blocks[32];
+        uint32_t seed = 0x13572468;
+        for(int block=0; block<32; block++)
+            for(int i=0; i<SALSA20_ENTRY_COUNT; i++)
+                sparse_blocks[block].entry[i].as_word32 = full_blocks[block].entry[i].as_word32 = seed = seed * 1103515245 + 12345;
+        scrypt_mixer<16,8,2,64,0,16*8*2*sizeof(Salsa20Block)> full;
+        full.Mix(full_blocks, 0);
+        scrypt_mixer<16,8,2,64,0,4*8*2*sizeof(Salsa20Block)> sparse_a, sparse_b;
+        scrypt_mixer<16,8,2,64,0,4*8*2*sizeof(Salsa20Block)>::MixInterleaved(sparse_a, sparse_b, sparse_blocks, 0);
+        assert( memcmp(sparse_blocks, full_blocks, sizeof(full_blocks)) == 0, true, "Sparse interleaved ROMix matches full sequential ROMix");
+        IO << "Test [Sparse interleaved ROMix] passed" << endl;
+    }
+
+#ifndef ARDUINO
+    // V array arena hands out what it was prewarmed with and nothing else
+    {
+        assert( scrypt_arena::prewarm(4096, 2), 2, "Arena prewarm count");
+        void * first = scrypt_arena::borrow(4096);
+        void * second = scrypt_arena::borrow(1024);
+        assert( ( first != NULL ) && ( second != NULL ) && ( first != second ), true, "Arena lends prewarmed buffers");
+        assert( scrypt_arena::borrow(4096) == NULL, true, "Arena has nothing more to lend");
+        assert( scrypt_arena::borrow(8192) == NULL, true, "Arena doesn't lend short buffers");
+        uint8_t not_from_arena[16];
+        assert( scrypt_arena::give_back(not_from_arena), false, "Arena refuses foreign buffers");
+        assert( scrypt_arena::give_back(first), true, "Arena takes back its own buffer");
+        assert( scrypt_arena::borrow(4096) == first, true, "Arena lends returned buffer again");
+        scrypt_arena::give_back(first);
+        scrypt_arena::give_back(second);
+        scrypt_arena::release();
+        assert( scrypt_arena::borrow(4096) == NULL, true, "Arena empty after release");
+        IO << "Test [scrypt V array arena] passed" << endl;
+    }
+#endif
+
 	scrypt<32768,8,2,64> scrypt3;
+    scrypt3.prewarm();
     r = scrypt3.hash( "", "", 0 );
     assert_hash(r, "dbf4a1bef9c302095a55b12c6901c42187774dd8d51f1444a43244710cd127905db9afdded6e233b2afbddd5003d383538d23cbf997325e21068977fc6d740f5", "scrypt #3", 64 );
 }
@@ -383,6 +1042,156 @@ void test_MPW(void)
         }
     }
 
+    // A login done a slice at a time ends up the same as one done in one go
+    {
+        MPW stepped;
+        stepped.begin_login("user", "password", 0);
+        assert( stepped.is_logged_in(), false, "Stepped login not logged in after begin");
+        while ( !stepped.step_login(4096) )
+            ;
+        assert( strcmp( stepped.generate("example.com", 1, Long, NULL, MPW_Scope_Authentication), "ZedaFaxcZaso9*" ) == 0, true, "Stepped login password");
+        IO << "Test [MPW stepped login] passed" << endl;
+    }
+
+    // A cancelled login stays logged out
+    {
+        MPW cancelled;
+        scrypt_cancel_token cancel;
+        cancel.cancel();
+        cancelled.login("user", "password", 0, scrypt_options(), &cancel);
+        assert( cancelled.is_logged_in(), false, "Cancelled login not logged in");
+        IO << "Test [MPW cancelled login] passed" << endl;
+    }
+
+    // Logging in again from the key cache skips scrypt, the only progress is the 100% and the
+    // MPW ends up just the same
+    {
+        mpw_key_cache cache;
+        MPW first, again;
+        first.set_key_cache(&cache);
+        again.set_key_cache(&cache);
+        first.login("user", "password", 0);
+        assert( cache.get_entry_count(), (uint8_t)1, "Key cache keeps the login");
+        uint32_t calls = 0;
+        again.login("user", "password", [&] ( uint8_t percent ) { calls++; } );
+        assert( ( calls == 1 ) && again.is_logged_in(), true, "Key cache login skips scrypt");
+        assert( strcmp( again.generate("example.com", 1, Long, NULL, MPW_Scope_Authentication), "ZedaFaxcZaso9*" ) == 0, true, "Key cache login password");
+
+        MPW stepped;
+        stepped.set_key_cache(&cache);
+        stepped.begin_login("user", "password", 0);
+        assert( stepped.is_logged_in() && stepped.step_login(1), true, "Key cache stepped login");
+
+        uint8_t d1[MPW_KEY_CACHE_DIGEST_LEN], d2[MPW_KEY_CACHE_DIGEST_LEN], d3[MPW_KEY_CACHE_DIGEST_LEN], key[MPW_KEY_CACHE_KEY_LEN];
+        cache.digest("user", "password2", d1);
+        cache.digest("user2", "password", d2);
+        cache.digest("user3", "password", d3);
+        assert( cache.find(d1, key) || cache.find(d2, key), false, "Key cache misses other logins");
+
+        // Full, the oldest goes. The stores are a few milliseconds apart so their ages differ.
+        // Flushed, they all go
+        mpw_key_cache small(MPW_KEY_CACHE_TTL_MS, 2);
+        memset( key, 0x5a, sizeof(key) );
+        small.store(d1, key);
+#ifdef ARDUINO
+        delay(5);
+#else
+        usleep(5000);
+#endif
+        small.store(d2, key);
+#ifdef ARDUINO
+        delay(5);
+#else
+        usleep(5000);
+#endif
+        small.store(d3, key);
+        assert( !small.find(d1, key) && small.find(d2, key) && small.find(d3, key), true, "Key cache evicts the oldest");
+        assert( small.get_entry_count(), (uint8_t)2, "Key cache stays full");
+        // d3 took the first slot, so the oldest is now in the second
+#ifdef ARDUINO
+        delay(5);
+#else
+        usleep(5000);
+#endif
+        small.store(d1, key);
+        assert( !small.find(d2, key) && small.find(d3, key) && small.find(d1, key), true, "Key cache evicts the oldest wherever it is");
+        small.flush();
+        assert( small.get_entry_count(), (uint8_t)0, "Key cache flushed");
+
+        mpw_key_cache brief(1, 4);
+        brief.store(d1, key);
+#ifdef ARDUINO
+        delay(5);
+#else
+        usleep(5000);
+#endif
+        assert( brief.find(d1, key), false, "Key cache entries expire");
+
+        mpw_key_cache off(0, 4);
+        off.store(d1, key);
+        assert( off.find(d1, key), false, "Key cache with no TTL keeps nothing");
+        IO << "Test [MPW key cache] passed" << endl;
+    }
+
+#ifndef ARDUINO
+    // Batch logins on two workers come out the same as logging in one at a time, and the pool
+    // is no bigger than the memory budget allows
+    {
+        mpw_batch small_budget(8, 2*(uint64_t)SCRYPT_N*SCRYPT_R*128);
+        assert( small_budget.get_worker_count() == 2, true, "Batch workers limited by memory budget");
+
+        const char* names[] = { "user", "Robert Lee Mitchell", "user" };
+        const char* passwords[] = { "password", "banana colored duckling", "password" };
+        mpw_batch batch(2);
+        uint32_t jobs[countof(names)];
+        for(unsigned int i=0; i<countof(names); i++)
+            jobs[i] = batch.add(names[i], passwords[i]);
+        uint8_t last_percent = 0;
+        bool in_order = true;
+        batch.wait( [&] ( uint8_t percent ) { in_order = in_order && ( percent >= last_percent ); last_percent = percent; } );
+        assert( in_order && ( last_percent == 100 ), true, "Batch progress");
+
+        MPW single;
+        for(unsigned int i=0; i<countof(names); i++)
+        {
+            assert( batch.is_done(jobs[i]) && ( batch.get_progress(jobs[i]) == 100 ), true, "Batch job done");
+            MPW batched;
+            assert( batch.login(jobs[i], batched), true, "Batch job logs in");
+            single.login(names[i], passwords[i], 0);
+            assert( strcmp( batched.generate("example.com", 1, Long, NULL, MPW_Scope_Authentication), single.generate("example.com", 1, Long, NULL, MPW_Scope_Authentication) ) == 0, true, "Batch login matches login");
+        }
+        MPW batched;
+        batch.login(jobs[0], batched);
+        assert( strcmp( batched.generate("example.com", 1, Long, NULL, MPW_Scope_Authentication), "ZedaFaxcZaso9*" ) == 0, true, "Batch login password");
+        assert( batch.get_warnings(jobs[0]), (uint8_t)0, "Batch job without warnings");
+
+        // Jobs side by side with the same named global tier file don't share V, and a file
+        // that can't be made is a warning on the job rather than on IO
+        char named[64];
+        snprintf( named, sizeof(named), "/tmp/empw-test-batch-v-%d", (int)getpid() );
+        const char * files[] = { named, "/nonexistent/empw-test-batch-v" };
+        for(unsigned int f=0; f<countof(files); f++)
+        {
+            scrypt_options options = mpw_batch::default_options();
+            options.global_size = SCRYPT_N*SCRYPT_R*128;
+            options.global_file = files[f];
+            mpw_batch filed(2, 0, options);
+            for(unsigned int i=0; i<2; i++)
+                jobs[i] = filed.add(names[i], passwords[i]);
+            filed.wait();
+            for(unsigned int i=0; i<2; i++)
+            {
+                MPW filed_login;
+                filed.login(jobs[i], filed_login);
+                single.login(names[i], passwords[i], 0);
+                assert( strcmp( filed_login.generate("example.com", 1, Long, NULL, MPW_Scope_Authentication), single.generate("example.com", 1, Long, NULL, MPW_Scope_Authentication) ) == 0, true, "Batch with a global tier file matches login");
+                assert( filed.get_warnings(jobs[i]), (uint8_t)( ( f == 0 ) ? 0 : SCRYPT_WARN_GLOBAL_MAP ), "Batch job warnings");
+            }
+        }
+        IO << "Test [MPW batch login] passed" << endl;
+    }
+#endif
+
     IO << "+=================================================+" << endl;
     IO << "|                                                 |" << endl;
     IO << "|         MasterPassword Tests Complete           |" << endl;